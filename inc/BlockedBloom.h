@@ -0,0 +1,50 @@
+#ifndef BLOCKED_BLOOM_H_
+#define BLOCKED_BLOOM_H_
+
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * Cache-line-blocked (split-block) Bloom filter. Every item maps to a single
+ * 64-byte block, and sets one bit in each of the block's 8 64-bit words, so a
+ * lookup costs one cache miss instead of one per probe. An item is tested by
+ * AND-ing the block with its 8-word bit pattern, which the compiler can do
+ * with vector instructions. The number of blocks is chosen for @error with
+ * this fixed pattern of 8 probes.
+ *
+ * TestAndSet is atomic, so one filter can be shared by several threads. Check
+ * must not run concurrently with TestAndSet.
+ */
+class BlockedBloom
+{
+public:
+    BlockedBloom(int64_t entries, double error);
+    ~BlockedBloom();
+
+    BlockedBloom(const BlockedBloom&) = delete;
+    BlockedBloom& operator=(const BlockedBloom&) = delete;
+
+    /*
+     * Items are given by their already computed 64-bit hash.
+     */
+    bool Check(uint64_t hashval) const;
+    bool TestAndSet(uint64_t hashval); /* adds the item, returns whether it was already there */
+
+    static constexpr int WORDS_PER_BLOCK = 8;
+
+    int64_t entries;
+    int64_t blocks;
+    double error;
+    int hashes; /* always WORDS_PER_BLOCK */
+
+private:
+    struct alignas(64) Block { uint64_t words[WORDS_PER_BLOCK]; };
+
+    Block *bf;
+
+    static uint64_t get_hash(uint64_t hashval);
+    const Block& get_block(uint64_t h) const;
+    static void get_pattern(uint64_t h, uint64_t *pattern);
+};
+
+#endif
@@ -13,6 +13,19 @@ public:
     bool Check(const void *buffer, size_t len);
     bool Add(const void *buffer, size_t len);
 
+    /*
+     * Same as above, but with the probe positions derived from an
+     * already computed 64-bit hash of the item.
+     */
+    bool Check(uint64_t hashval);
+    bool Add(uint64_t hashval);
+
+    /*
+     * Adds the item and returns whether it was already there (same as Add,
+     * named after BlockedBloom::TestAndSet). Not thread-safe.
+     */
+    bool TestAndSet(uint64_t hashval) { return Add(hashval); }
+
     int64_t entries;
     int64_t bits;
     int64_t bytes;
@@ -25,6 +38,7 @@ private:
     bool ready;
 
     bool bloom_check_add(const void *buffer, size_t len, bool add);
+    bool bloom_check_add(uint64_t a, uint64_t b, bool add);
 };
 
 #endif
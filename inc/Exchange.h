@@ -0,0 +1,59 @@
+#ifndef EXCHANGE_H_
+#define EXCHANGE_H_
+
+#include "common.h"
+#include "Profiler.h"
+
+/*
+ * HIERARCHICAL_EXCHANGE == 1 routes the k-mer and seed exchanges through the
+ * processor grid in two stages instead of one flat all-to-all over the whole
+ * world: every processor first sends to the processors of its grid row, each
+ * of which relays what it got to the processors of its grid column. Data for
+ * processor (i,j) from processor (k,l) goes through processor (k,j). On a
+ * p = r*c grid every processor then sends r+c messages instead of p, each
+ * about sqrt(p) times larger, at the cost of moving every byte twice.
+ *
+ * The results are the same as those of the flat exchange, byte for byte.
+ */
+#ifndef HIERARCHICAL_EXCHANGE
+#define HIERARCHICAL_EXCHANGE 0
+#endif
+
+/*
+ * What ExchangeCounts learns about an exchange that ExchangeBytes needs again.
+ * Both count their collectives and bytes in @phase, each stage of the
+ * hierarchical exchange separately.
+ */
+struct ExchangePlan
+{
+    ExchangePlan(ProfilePhase phase) : phase(phase) {}
+
+    ProfilePhase phase;
+    Vector<MPI_Count_type> relayed; /* hierarchical exchange only: relayed[l*r + i] is what processor (myrow, l) sends to (i, mycol) */
+};
+
+/*
+ * Fills in the displacements of a send buffer with @sendcnt bytes for each
+ * processor, which ExchangeBytes sends from without copying: in rank order
+ * in the flat exchange, and in the hierarchical one ordered by destination
+ * column and then row, which is the order of its first stage.
+ */
+void GetSendDispls(const Vector<MPI_Count_type>& sendcnt, Vector<MPI_Displ_type>& sdispls, SharedPtr<CommGrid> commgrid);
+
+/*
+ * Same as an MPI_ALLTOALL of one MPI_Count_type per processor over
+ * commgrid->GetWorld(): @recvcnt[k] becomes @sendcnt[myrank] of processor k.
+ */
+void ExchangeCounts(const Vector<MPI_Count_type>& sendcnt, Vector<MPI_Count_type>& recvcnt, ExchangePlan& plan, SharedPtr<CommGrid> commgrid);
+
+/*
+ * Same as an MPI_ALLTOALLV of MPI_BYTEs over commgrid->GetWorld(), where
+ * @recvcnt and @plan are what ExchangeCounts returned for @sendcnt. In the
+ * hierarchical exchange @sdispls must come from GetSendDispls and @rdispls
+ * must be the prefix sums of @recvcnt, as everywhere in this code base.
+ */
+void ExchangeBytes(const uint8_t *sendbuf, const Vector<MPI_Count_type>& sendcnt, const Vector<MPI_Displ_type>& sdispls,
+                   uint8_t *recvbuf, const Vector<MPI_Count_type>& recvcnt, const Vector<MPI_Displ_type>& rdispls,
+                   const ExchangePlan& plan, SharedPtr<CommGrid> commgrid);
+
+#endif
@@ -2,6 +2,28 @@
 #define FASTA_INDEX_H_
 
 #include "common.h"
+#include "ReadStore.h"
+
+/*
+ * BALANCED_READS == 1 gives every process a contiguous range of .fai records
+ * with about the same total number of bases, instead of the same number of
+ * records, so that processes also parse about the same number of k-mers when
+ * read lengths vary a lot.
+ */
+#ifndef BALANCED_READS
+#define BALANCED_READS 0
+#endif
+
+/*
+ * PARALLEL_FAIDX == 1 loads the .fai in parallel instead of on the root: every
+ * process reads one byte range of it, keeps the lines that start in that range,
+ * and the records are then redistributed to the processes that own them. When
+ * there is no .fai, the processes build the index from byte ranges of the FASTA
+ * file instead, and try to write it out for the next run.
+ */
+#ifndef PARALLEL_FAIDX
+#define PARALLEL_FAIDX 0
+#endif
 
 typedef struct faidx_record { size_t len, pos, bases; } faidx_record_t;
 
@@ -12,8 +34,7 @@ public:
 
     SharedPtr<CommGrid> getcommgrid() const { return commgrid; }
     const Vector<faidx_record_t>& getrecords() const { return records; }
-    Vector<String> GetMyReads();
-    // static Vector<String> GetMyReads(const FastaIndex& index);
+    ReadStore GetMyReads();
 
     void PrintInfo() const;
 
@@ -0,0 +1,122 @@
+#ifndef FLAT_HASH_MAP_H_
+#define FLAT_HASH_MAP_H_
+
+#include "common.h"
+#include <cstdint>
+#include <cassert>
+#include <type_traits>
+
+/*
+ * Open-addressing hash map with linear probing. The probe sequence only touches
+ * two flat per-slot arrays (control bytes and keys), while the values live in a
+ * separate dense array that only grows with the number of inserted keys, so
+ * empty slots cost sizeof(K) + 5 bytes instead of a whole value.
+ *
+ * Lookups take the key's hash as an argument so that callers who already
+ * computed it (e.g. THashedKmer) never hash the same key twice. The hash
+ * function H is only used to rehash keys when the table grows, and must
+ * agree with the hashes passed in.
+ */
+template <class K, class V, class H = Hash<K>>
+class FlatHashMap
+{
+public:
+
+    template <bool IS_CONST>
+    class Iterator
+    {
+    public:
+        typedef typename std::conditional<IS_CONST, const FlatHashMap, FlatHashMap>::type map_type;
+        typedef typename std::conditional<IS_CONST, const V, V>::type mapped_type;
+
+        struct reference { const K& first; mapped_type& second; };
+        struct pointer { reference ref; const reference* operator->() const { return &ref; } };
+
+        Iterator(map_type *map, size_t pos) : map(map), pos(pos) { skip(); }
+
+        operator Iterator<true>() const { return Iterator<true>(map, pos); }
+
+        reference operator*() const { return {map->keys[map->slots[pos]], map->values[pos]}; }
+        pointer operator->() const { return {**this}; }
+
+        Iterator& operator++() { ++pos; skip(); return *this; }
+
+        bool operator==(const Iterator& o) const { return pos == o.pos; }
+        bool operator!=(const Iterator& o) const { return pos != o.pos; }
+
+    private:
+        map_type *map;
+        size_t pos; /* position in the dense value array */
+
+        void skip() { while (pos < map->slots.size() && map->slots[pos] == ERASED) ++pos; }
+
+        friend class FlatHashMap;
+    };
+
+    typedef Iterator<false> iterator;
+    typedef Iterator<true> const_iterator;
+
+    FlatHashMap() : numlive(0), numused(0) {}
+
+    size_t size() const { return numlive; }
+    bool empty() const { return numlive == 0; }
+    size_t bucket_count() const { return ctrl.size(); }
+
+    void reserve(size_t n);
+
+    iterator find(const K& key, uint64_t hash);
+    const_iterator find(const K& key, uint64_t hash) const;
+
+    /*
+     * Inserts a value-initialized V for @key if it isn't there yet.
+     */
+    std::pair<iterator, bool> try_emplace(const K& key, uint64_t hash);
+
+    iterator erase(const_iterator pos);
+
+    /*
+     * Erases every entry for which pred(entry) is true, where entry has the
+     * same .first/.second members as *iterator, and then compacts the dense
+     * value array. Returns the number of erased entries.
+     */
+    template <typename Predicate>
+    size_t erase_if(Predicate pred);
+
+    iterator begin() { return iterator(this, 0); }
+    iterator end() { return iterator(this, values.size()); }
+    const_iterator begin() const { return cbegin(); }
+    const_iterator end() const { return cend(); }
+    const_iterator cbegin() const { return const_iterator(this, 0); }
+    const_iterator cend() const { return const_iterator(this, values.size()); }
+
+private:
+
+    static constexpr uint8_t EMPTY = 0;
+    static constexpr uint8_t TOMBSTONE = 1;
+    static constexpr uint32_t ERASED = std::numeric_limits<uint32_t>::max();
+
+    /*
+     * At most 4/5 of the slots may be used (live keys plus tombstones).
+     */
+    static constexpr size_t MAX_LOAD_NUM = 4;
+    static constexpr size_t MAX_LOAD_DEN = 5;
+
+    Vector<uint8_t> ctrl;   /* per slot: EMPTY, TOMBSTONE, or 0x80 | 7-bit hash tag */
+    Vector<K> keys;         /* per slot: key stored in the slot */
+    Vector<uint32_t> index; /* per slot: position of the slot's value in the dense arrays */
+
+    Vector<V> values;       /* dense: values in insertion order */
+    Vector<uint32_t> slots; /* dense: slot holding the key of values[i], or ERASED */
+
+    size_t numlive; /* number of keys in the table */
+    size_t numused; /* number of non-empty slots (keys and tombstones) */
+
+    static uint8_t get_tag(uint64_t hash) { return 0x80 | ((hash >> 32) & 0x7f); }
+
+    size_t probe(const K& key, uint64_t hash) const;
+    void rehash(size_t numslots);
+};
+
+#include "FlatHashMap.cpp"
+
+#endif
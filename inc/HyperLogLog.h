@@ -12,6 +12,7 @@ public:
 
     void Add(char const *s, size_t len);
     void Add(const String& s) { Add(s.c_str(), s.size()); }
+    void Add(uint64_t hashval); /* add an item by its precomputed 64-bit hash */
     double Estimate() const;
     void Merge(const HyperLogLog& rhs);
     HyperLogLog& ParallelMerge(MPI_Comm comm);
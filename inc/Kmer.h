@@ -19,6 +19,27 @@
 #error "KMER_SIZE must be in the range (0,96) and must be odd"
 #endif
 
+/*
+ * KMER_SIMD selects the kernel that Kmer::MakeRepKmers uses to canonicalize
+ * a batch of k-mers: 0 is portable scalar code, 1 is AVX2, 2 is AVX-512 and
+ * 3 is NEON. The instruction set must be enabled for the compiler as well.
+ */
+#ifndef KMER_SIMD
+#define KMER_SIMD 0
+#endif
+
+/*
+ * Everything that depends on KMER_SIZE, LOWER_KMER_FREQ, UPPER_KMER_FREQ and
+ * USE_BLOOM lives in the inline namespace PIPELINE_NAMESPACE, so that pipeline
+ * instances compiled with different values of them can be linked into the
+ * same binary (see Pipeline.h). Each instance gets its own namespace.
+ */
+#ifndef PIPELINE_NAMESPACE
+#define PIPELINE_NAMESPACE pipeline
+#endif
+
+inline namespace PIPELINE_NAMESPACE {
+
 template <int N_LONGS>
 class Kmer
 {
@@ -27,6 +48,7 @@ public:
     static_assert(N_LONGS != 0);
 
     static constexpr int N_BYTES = 8 * N_LONGS;
+    static constexpr int N_PACKED_BYTES = (2 * KMER_SIZE + 7) / 8; /* just the 2*KMER_SIZE bits of the bases */
 
     typedef Array<uint64_t, N_LONGS> MERARR;
     typedef Array<uint8_t,  N_BYTES> BYTEARR;
@@ -50,14 +72,34 @@ public:
     Kmer GetRep() const;
 
     uint64_t GetHash() const;
+    uint64_t GetNtCode(int i) const { return (longs[i/32] >> (2 * (31 - i%32))) & 3; } /* 2-bit code of the i-th base */
     const void* GetBytes() const { return reinterpret_cast<const void*>(longs.data()); }
 
     void CopyDataInto(void *mem) const { std::memcpy(mem, longs.data(), N_BYTES); }
     void CopyDataFrom(const void *mem) { std::memcpy(longs.data(), mem, N_BYTES); }
 
+    /*
+     * Same as above, but only N_PACKED_BYTES bytes are copied (the
+     * unused low bits of the last word are dropped).
+     */
+    void CopyPackedDataInto(void *mem) const;
+    void CopyPackedDataFrom(const void *mem);
+
     static Vector<Kmer> GetKmers(const String& s);
     static Vector<Kmer> GetRepKmers(const String& s);
 
+    /*
+     * Replaces each of the @count k-mers at @kmers by its representative,
+     * several k-mers at a time with the KMER_SIMD kernel.
+     */
+    static void MakeRepKmers(Kmer *kmers, size_t count);
+
+    template <typename KmerHandler>
+    static void ForeachRepKmer(char const *s, size_t len, KmerHandler&& handler);
+
+    template <typename KmerHandler>
+    static void ForeachRepKmer(const uint64_t *words, size_t first, size_t len, KmerHandler&& handler);
+
     template <int N>
     friend std::ostream& operator<<(std::ostream& os, const Kmer<N>& kmer);
 
@@ -67,6 +109,8 @@ private:
             BYTEARR bytes; };
 
     void set_kmer(char const *s, bool const revcomp = false);
+    void roll_forward(uint64_t const code);
+    void roll_reverse(uint64_t const code);
 };
 
 template <int N_LONGS>
@@ -76,6 +120,28 @@ std::ostream& operator<<(std::ostream& os, const Kmer<N_LONGS>& kmer)
     return os;
 }
 
+/*
+ * A k-mer bundled with its hash. The hash is computed once when the
+ * k-mer is created (or received) and is then reused for ownership,
+ * Bloom filter, and hash table lookups.
+ */
+template <class KMER>
+struct HashedKmer
+{
+    KMER kmer;
+    uint64_t hash;
+
+    HashedKmer() : kmer(), hash(kmer.GetHash()) {}
+    HashedKmer(const KMER& kmer) : kmer(kmer), hash(kmer.GetHash()) {}
+    HashedKmer(const void *mem) : kmer(mem), hash(kmer.GetHash()) {}
+    HashedKmer(const KMER& kmer, uint64_t hash) : kmer(kmer), hash(hash) {} /* @hash must be kmer.GetHash() */
+
+    bool operator==(const HashedKmer& o) const { return hash == o.hash && kmer == o.kmer; }
+    bool operator!=(const HashedKmer& o) const { return !(*this == o); }
+};
+
+} /* namespace PIPELINE_NAMESPACE */
+
 namespace std
 {
     template <int N_LONGS> struct hash<Kmer<N_LONGS>>
@@ -87,6 +153,14 @@ namespace std
         }
     };
 
+    template <class KMER> struct hash<HashedKmer<KMER>>
+    {
+        size_t operator()(const HashedKmer<KMER>& hmer) const
+        {
+            return hmer.hash;
+        }
+    };
+
     template <int N_LONGS> struct less<Kmer<N_LONGS>>
     {
         bool operator()(const Kmer<N_LONGS>& k1, const Kmer<N_LONGS>& k2) const
@@ -98,8 +172,14 @@ namespace std
 
 #include "Kmer.cpp"
 
+inline namespace PIPELINE_NAMESPACE {
+
 using TKmer = typename std::conditional<(KMER_SIZE <= 32), Kmer<1>,
               typename std::conditional<(KMER_SIZE <= 64), Kmer<2>,
               typename std::conditional<(KMER_SIZE <= 96), Kmer<3>, Kmer<0>>::type>::type>::type;
 
+using THashedKmer = HashedKmer<TKmer>;
+
+} /* namespace PIPELINE_NAMESPACE */
+
 #endif
@@ -3,6 +3,10 @@
 
 #include "common.h"
 #include "Kmer.h"
+#include "FlatHashMap.h"
+#include "ReadStore.h"
+#include "HashFuncs.h"
+#include <deque>
 
 #ifndef LOWER_KMER_FREQ
 #error "LOWER_KMER_FREQ must be defined"
@@ -16,19 +20,239 @@
 #error "LOWER_KMER_FREQ must be less than or equal to UPPER_KMER_FREQ"
 #endif
 
+/*
+ * FUSED_KMER_PASS == 1 parses the reads only once: the HyperLogLog sketch and
+ * the outgoing seed buckets are filled by the same pass, and the packed seeds
+ * are cached until the second exchange instead of re-scanning the reads.
+ */
+#ifndef FUSED_KMER_PASS
+#define FUSED_KMER_PASS 0
+#endif
+
+/*
+ * CSR_SEEDS == 1 stores the read ids and positions of all k-mers in one
+ * contiguous occurrence buffer (KmerSeedBuffer) instead of fixed-size arrays
+ * inside each KmerCountEntry. GetKmerCountMapValues first counts the
+ * occurrences of each k-mer, then prefix-sums the counts of the k-mers within
+ * [LOWER_KMER_FREQ, UPPER_KMER_FREQ] into buffer offsets, and then fills in the
+ * read ids and positions in a second sweep over the received seeds.
+ */
+#ifndef CSR_SEEDS
+#define CSR_SEEDS 0
+#endif
+
+/*
+ * SORT_COUNTING == 1 counts k-mers by radix-sorting the received k-mers and
+ * seeds and scanning the runs of equal k-mers, instead of probing the hash
+ * table (and Bloom filter) once per received k-mer. Counts are exact, so only
+ * reliable k-mers are inserted into the KmerCountMap. Requires USE_BLOOM == 0.
+ */
+#ifndef SORT_COUNTING
+#define SORT_COUNTING 0
+#endif
+
+/*
+ * SEED_BATCH_MB > 0 bounds the memory of the second k-mer exchange: the local
+ * reads are parsed, exchanged and added to the KmerCountMap in batches of about
+ * SEED_BATCH_MB megabytes of seeds per processor, instead of materializing every
+ * seed at once. The exchange of one batch (MPI_Ialltoallv) overlaps with parsing
+ * the next one, so two batches are in flight at a time. Not supported together
+ * with FUSED_KMER_PASS or CSR_SEEDS, which both keep every seed around anyway.
+ */
+#ifndef SEED_BATCH_MB
+#define SEED_BATCH_MB 0
+#endif
+
+/*
+ * COMPACT_SEEDS == 1 shrinks the seeds sent in the second k-mer exchange: the
+ * k-mer is sent as just its 2*KMER_SIZE bits (TKmer::N_PACKED_BYTES) and the
+ * read id as a 32-bit id relative to the sender's first read, which the
+ * receiver turns back into a global id using the Allgathered read offsets.
+ * Received seeds are expanded in place to the usual KMER_SEED_BYTES layout.
+ * Not supported together with FUSED_KMER_PASS.
+ */
+#ifndef COMPACT_SEEDS
+#define COMPACT_SEEDS 0
+#endif
+
+/*
+ * USE_OPENMP == 1 runs each processor's k-mer work on OpenMP threads (build
+ * with -fopenmp). Both exchanges parse and pack contiguous ranges of reads on
+ * separate threads, and the received k-mers are split into one shard per
+ * thread by hash bits, with a hash set and Bloom filter per shard, so that
+ * threads never touch the same k-mer. The reliable k-mers and their seeds are
+ * the same for any number of threads (so is the KmerCountMap order, except that
+ * Bloom filter false positives can move a k-mer up). The radix sort of
+ * SORT_COUNTING is split between the threads too, but the fused and CSR
+ * passes and the run counting after the sort stay serial.
+ */
+#ifndef USE_OPENMP
+#define USE_OPENMP 0
+#endif
+
+/*
+ * BLOCKED_BLOOM == 1 replaces the Bloom filter with a cache-line-blocked one
+ * (BlockedBloom) whose TestAndSet is atomic, so that the threads of USE_OPENMP
+ * share a single filter instead of keeping one per shard. Requires USE_BLOOM == 1.
+ */
+#ifndef BLOCKED_BLOOM
+#define BLOCKED_BLOOM 0
+#endif
+
+/*
+ * SKEW_AWARE_PARTITION == 1 partitions the seed k-mers with the
+ * SkewAwareKmerPartitioner instead of the UniformKmerPartitioner, which
+ * stops sending the seeds of k-mers that this processor alone has already
+ * seen more than UPPER_KMER_FREQ+1 times. Has no effect on FUSED_KMER_PASS,
+ * whose seeds are bucketed during the HyperLogLog pass.
+ */
+#ifndef SKEW_AWARE_PARTITION
+#define SKEW_AWARE_PARTITION 0
+#endif
+
+/*
+ * PREAGGREGATE_KMERS == 1 combines duplicate k-mers on the sending side of the
+ * first k-mer exchange: every thread counts the seed k-mers of its reads in a
+ * local hash table, and each distinct k-mer is sent once along with its local
+ * count (KMER_COUNT_BYTES). The owner sums up the counts exactly, so only the
+ * reliable k-mers are inserted and no Bloom filter is needed. Requires
+ * USE_BLOOM == 0 and FUSED_KMER_PASS == 0. SORT_COUNTING and SKEW_AWARE_PARTITION
+ * then only apply to the second exchange.
+ */
+#ifndef PREAGGREGATE_KMERS
+#define PREAGGREGATE_KMERS 0
+#endif
+
+/*
+ * SEED_POLICY selects the seed k-mers that ForeachKmer enumerates, and thus
+ * the seeds that are counted, exchanged and put into the overlap matrix:
+ *
+ *   0: every k-mer of every read;
+ *   1: (MINIMIZER_WINDOW, KMER_SIZE)-minimizers, i.e. in every window of
+ *      MINIMIZER_WINDOW consecutive k-mers of a read, the one whose hash
+ *      comes first (MinimizerSeedPolicy);
+ *   2: closed syncmers, i.e. the k-mers whose smallest SYNCMER_SIZE-mer
+ *      (by the hash of its canonical form) is their first or last one
+ *      (SyncmerSeedPolicy).
+ *
+ * Both exchanges sample the same seeds, so LOWER_KMER_FREQ and UPPER_KMER_FREQ
+ * then bound the number of sampled occurrences of each k-mer.
+ */
+#ifndef SEED_POLICY
+#define SEED_POLICY 0
+#endif
+
+#ifndef MINIMIZER_WINDOW
+#define MINIMIZER_WINDOW 10
+#endif
+
+#ifndef SYNCMER_SIZE
+#define SYNCMER_SIZE 15
+#endif
+
+inline namespace PIPELINE_NAMESPACE {
+
 typedef uint16_t PosInRead;
 typedef uint64_t ReadId;
 
+#if CSR_SEEDS == 1
+typedef PosInRead* POSITIONS; /* points into KmerSeedBuffer::positions */
+typedef ReadId*    READIDS;   /* points into KmerSeedBuffer::readids   */
+#else
+static_assert(CSR_SEEDS == 0);
 typedef Array<PosInRead, UPPER_KMER_FREQ> POSITIONS;
 typedef Array<ReadId,    UPPER_KMER_FREQ> READIDS;
+#endif
 
 typedef Tuple<TKmer, ReadId, PosInRead> KmerSeed;
+
+static constexpr size_t KMER_SEED_BYTES = TKmer::N_BYTES + sizeof(ReadId) + sizeof(PosInRead); /* packed size of a KmerSeed */
+
+#if COMPACT_SEEDS == 1
+typedef uint32_t LocalReadId; /* read id relative to the sender's first read */
+static constexpr size_t SEED_WIRE_BYTES = TKmer::N_PACKED_BYTES + sizeof(LocalReadId) + sizeof(PosInRead);
+#else
+static_assert(COMPACT_SEEDS == 0);
+static constexpr size_t SEED_WIRE_BYTES = KMER_SEED_BYTES; /* size of a seed in the second exchange */
+#endif
+typedef uint32_t LocalKmerCount; /* number of seeds of a k-mer on one sender thread */
+static constexpr size_t KMER_COUNT_BYTES = TKmer::N_BYTES + sizeof(LocalKmerCount); /* packed size of a k-mer and its count */
+
 typedef Tuple<READIDS, POSITIONS, int> KmerCountEntry;
-typedef Map<TKmer, KmerCountEntry> KmerCountMap;
+typedef FlatHashMap<TKmer, KmerCountEntry> KmerCountMap; /* keyed by TKmer, probed with THashedKmer::hash */
+
+#if CSR_SEEDS == 1
+/*
+ * Occurrence buffer of the reliable k-mers. The occurrences of each k-mer are
+ * stored contiguously, and the k-mers appear in the same order as they do when
+ * iterating over the KmerCountMap that points into the buffer.
+ */
+struct KmerSeedBuffer
+{
+    Vector<ReadId> readids;
+    Vector<PosInRead> positions;
+};
+#endif
 
-KmerCountMap GetKmerCountMapKeys(const Vector<String>& myreads, SharedPtr<CommGrid> commgrid);
-void GetKmerCountMapValues(const Vector<String>& myreads, KmerCountMap& kmermap, SharedPtr<CommGrid> commgrid);
+KmerCountMap GetKmerCountMapKeys(const ReadStore& myreads, SharedPtr<CommGrid> commgrid);
+
+#if CSR_SEEDS == 1
+void GetKmerCountMapValues(const ReadStore& myreads, KmerCountMap& kmermap, KmerSeedBuffer& seedbuf, SharedPtr<CommGrid> commgrid);
+#else
+void GetKmerCountMapValues(const ReadStore& myreads, KmerCountMap& kmermap, SharedPtr<CommGrid> commgrid);
+#endif
 int GetKmerOwner(const TKmer& kmer, int nprocs);
+int GetKmerOwner(const THashedKmer& kmer, int nprocs);
+int GetKmerOwner(uint64_t kmerhash, int nprocs);
+
+/*
+ * A k-mer partitioner is called on every seed k-mer, in the order in which
+ * the seeds are enumerated, and returns the processor that the seed is sent
+ * to, or -1 if the seed doesn't need to be sent at all. The same k-mer must
+ * always go to the same processor.
+ */
+struct UniformKmerPartitioner
+{
+    int nprocs;
+
+    UniformKmerPartitioner(int nprocs, size_t maxnumseeds) : nprocs(nprocs) {}
+
+    int operator()(const THashedKmer& hmer) { return GetKmerOwner(hmer, nprocs); }
+};
+
+/*
+ * Uniform partitioner that also drops the seeds of k-mers that are certain to
+ * be above UPPER_KMER_FREQ. A count-min sketch (an upper bound on the local
+ * count of every k-mer) picks the candidates, whose seeds are then counted
+ * exactly from that point on (a lower bound on their count). Once more than
+ * UPPER_KMER_FREQ+1 seeds of a k-mer have been counted, its remaining seeds
+ * are dropped: the owner has already been sent more than UPPER_KMER_FREQ of
+ * them, so it will discard the k-mer anyway.
+ */
+class SkewAwareKmerPartitioner
+{
+public:
+    SkewAwareKmerPartitioner(int nprocs, size_t maxnumseeds);
+
+    int operator()(const THashedKmer& hmer);
+
+    size_t numdropped; /* number of seeds dropped so far */
+
+private:
+    static constexpr int SKETCH_ROWS = 3;
+
+    int nprocs;
+    uint64_t mask;                        /* sketch row width - 1 */
+    Vector<uint16_t> sketch;              /* SKETCH_ROWS rows of saturating counters */
+    FlatHashMap<TKmer, int> candidates;   /* exact count of each candidate since it became one */
+};
+
+#if SKEW_AWARE_PARTITION == 1
+typedef SkewAwareKmerPartitioner KmerPartitioner;
+#else
+static_assert(SKEW_AWARE_PARTITION == 0);
+typedef UniformKmerPartitioner KmerPartitioner;
+#endif
 
 struct KmerEstimateHandler
 {
@@ -38,68 +262,407 @@ struct KmerEstimateHandler
 
     void operator()(const TKmer& kmer, size_t kid, size_t rid)
     {
-        hll.Add(kmer.GetString().c_str());
+        /*
+         * The HyperLogLog only needs a uniformly distributed hash of
+         * each k-mer, so hash the packed k-mer words directly.
+         */
+        hll.Add(kmer.GetHash());
+    }
+};
+
+/*
+ * First pass of the two-pass partitioner: finds the owner of every seed k-mer
+ * with @partitioner, in the order the seeds are enumerated, and adds @recbytes
+ * to the send count of that owner. If @hll is given, the same hash is also
+ * added to it.
+ */
+struct KmerCountingHandler
+{
+    size_t recbytes;
+    Vector<MPI_Count_type>& sendcnt;
+    Vector<int>& owners;
+    KmerPartitioner& partitioner;
+    HyperLogLog *hll;
+
+    KmerCountingHandler(Vector<MPI_Count_type>& sendcnt, Vector<int>& owners, KmerPartitioner& partitioner, size_t recbytes, HyperLogLog *hll = nullptr) : recbytes(recbytes), sendcnt(sendcnt), owners(owners), partitioner(partitioner), hll(hll) {}
+
+    void operator()(const TKmer& kmer, size_t kid, size_t rid)
+    {
+        THashedKmer hmer(kmer);
+
+        if (hll) hll->Add(hmer.hash);
+
+        int owner = partitioner(hmer);
+
+        if (owner >= 0) sendcnt[owner] += recbytes;
+        owners.push_back(owner);
     }
 };
 
-struct KmerPartitionHandler
+struct LocalKmerEntry
+{
+    LocalKmerCount count;
+    int owner;
+};
+
+typedef FlatHashMap<TKmer, LocalKmerEntry> LocalKmerCountMap; /* local seed count and owner of each k-mer */
+
+/*
+ * Local combine step of PREAGGREGATE_KMERS: counts the seed k-mers in
+ * @localcounts. The owner of a k-mer (and its record in @sendcnt) is only
+ * found the first time the k-mer is seen, and so is its hash added to @hll,
+ * which only depends on the distinct k-mers anyway.
+ */
+struct KmerCombiningHandler
 {
     int nprocs;
-    Vector<Vector<TKmer>>& kmerbuckets;
+    LocalKmerCountMap& localcounts;
+    Vector<MPI_Count_type>& sendcnt;
+    HyperLogLog& hll;
+
+    KmerCombiningHandler(LocalKmerCountMap& localcounts, Vector<MPI_Count_type>& sendcnt, HyperLogLog& hll) : nprocs(sendcnt.size()), localcounts(localcounts), sendcnt(sendcnt), hll(hll) {}
+
+    void operator()(const TKmer& kmer, size_t kid, size_t rid)
+    {
+        THashedKmer hmer(kmer);
+
+        auto [itr, inserted] = localcounts.try_emplace(hmer.kmer, hmer.hash);
+
+        if (inserted)
+        {
+            hll.Add(hmer.hash);
+
+            itr->second.owner = GetKmerOwner(hmer, nprocs);
+            sendcnt[itr->second.owner] += KMER_COUNT_BYTES;
+        }
+
+        itr->second.count++;
+    }
+};
+
+/*
+ * Second pass of the two-pass partitioner: writes each seed k-mer straight
+ * into the send buffer, at the next free spot of the owner found by the first
+ * pass. Must enumerate exactly the same seeds as the first pass.
+ */
+struct KmerPackingHandler
+{
+    uint8_t *sendbuf;
+    const Vector<int>& owners;
+    Vector<MPI_Displ_type> offsets; /* next free byte of each owner's part of sendbuf */
+    size_t i;
+
+    KmerPackingHandler(uint8_t *sendbuf, const Vector<MPI_Displ_type>& sdispls, const Vector<int>& owners) : sendbuf(sendbuf), owners(owners), offsets(sdispls), i(0) {}
 
-    KmerPartitionHandler(Vector<Vector<TKmer>>& kmerbuckets) : nprocs(kmerbuckets.size()), kmerbuckets(kmerbuckets) {}
+    void operator()(const TKmer& kmer, size_t kid, size_t rid)
+    {
+        int owner = owners[i++];
+
+        if (owner < 0) return; /* dropped by the partitioner */
+
+        MPI_Displ_type& offset = offsets[owner];
+
+        kmer.CopyDataInto(sendbuf + offset);
+        offset += TKmer::N_BYTES;
+    }
+};
+
+/*
+ * Same as KmerPackingHandler, but writes whole seeds (SEED_WIRE_BYTES each).
+ */
+struct KmerSeedPackingHandler
+{
+    uint8_t *sendbuf;
+    ReadId readoffset;
+    const Vector<int>& owners;
+    Vector<MPI_Displ_type> offsets;
+    size_t i;
+
+    KmerSeedPackingHandler(uint8_t *sendbuf, const Vector<MPI_Displ_type>& sdispls, const Vector<int>& owners, ReadId readoffset) : sendbuf(sendbuf), readoffset(readoffset), owners(owners), offsets(sdispls), i(0) {}
 
     void operator()(const TKmer& kmer, size_t kid, size_t rid)
     {
-        kmerbuckets[GetKmerOwner(kmer, nprocs)].push_back(kmer);
+        int owner = owners[i++];
+
+        if (owner < 0) return;
+
+        MPI_Displ_type& offset = offsets[owner];
+
+        PosInRead pos = static_cast<PosInRead>(kid);
+
+        uint8_t *addrs2fill = sendbuf + offset;
+
+#if COMPACT_SEEDS == 1
+        assert(rid <= std::numeric_limits<LocalReadId>::max());
+        LocalReadId readid = static_cast<LocalReadId>(rid);
+
+        kmer.CopyPackedDataInto(addrs2fill);
+        std::memcpy(addrs2fill + TKmer::N_PACKED_BYTES, &readid, sizeof(LocalReadId));
+        std::memcpy(addrs2fill + TKmer::N_PACKED_BYTES + sizeof(LocalReadId), &pos, sizeof(PosInRead));
+#else
+        ReadId readid = static_cast<ReadId>(rid) + readoffset;
+
+        kmer.CopyDataInto(addrs2fill);
+        std::memcpy(addrs2fill + TKmer::N_BYTES, &readid, sizeof(ReadId));
+        std::memcpy(addrs2fill + TKmer::N_BYTES + sizeof(ReadId), &pos, sizeof(PosInRead));
+#endif
+
+        offset += SEED_WIRE_BYTES;
     }
 };
 
-struct KmerParserHandler
+struct KmerFusedHandler
 {
     int nprocs;
     ReadId readoffset;
-    Vector<Vector<KmerSeed>>& kmerseeds;
+    HyperLogLog& hll;
+    Vector<Vector<uint8_t>>& seedbuckets;
 
-    KmerParserHandler(Vector<Vector<KmerSeed>>& kmerseeds, ReadId readoffset) : nprocs(kmerseeds.size()), readoffset(readoffset), kmerseeds(kmerseeds) {}
+    KmerFusedHandler(HyperLogLog& hll, Vector<Vector<uint8_t>>& seedbuckets, ReadId readoffset) : nprocs(seedbuckets.size()), readoffset(readoffset), hll(hll), seedbuckets(seedbuckets) {}
 
     void operator()(const TKmer& kmer, size_t kid, size_t rid)
     {
-        kmerseeds[GetKmerOwner(kmer, nprocs)].emplace_back(kmer, static_cast<ReadId>(rid) + readoffset, static_cast<PosInRead>(kid));
+        /*
+         * One hash of the k-mer serves both the HyperLogLog and the partitioner.
+         */
+        THashedKmer hmer(kmer);
+
+        hll.Add(hmer.hash);
+
+        /*
+         * Seeds are stored already packed (KMER_SEED_BYTES each, no tuple
+         * padding) so that the bucket can be copied into the send buffer as is.
+         */
+        Vector<uint8_t>& bucket = seedbuckets[GetKmerOwner(hmer, nprocs)];
+
+        ReadId readid = static_cast<ReadId>(rid) + readoffset;
+        PosInRead pos = static_cast<PosInRead>(kid);
+
+        size_t offset = bucket.size();
+        bucket.resize(offset + KMER_SEED_BYTES);
+
+        uint8_t *addrs2fill = bucket.data() + offset;
+
+        kmer.CopyDataInto(addrs2fill);
+        std::memcpy(addrs2fill + TKmer::N_BYTES, &readid, sizeof(ReadId));
+        std::memcpy(addrs2fill + TKmer::N_BYTES + sizeof(ReadId), &pos, sizeof(PosInRead));
     }
+};
+
+/*
+ * Seed policies are called on every representative k-mer of a read in order,
+ * as policy(kmer, fwdmer, pos, emit), where fwdmer is the k-mer as it reads on
+ * the forward strand, and pass the ones that are seeds on to emit(kmer, pos),
+ * in increasing order of position. Finish(emit) is called after the last k-mer
+ * of each read.
+ */
+struct AllSeedPolicy
+{
+    template <typename Emit>
+    void operator()(const TKmer& kmer, const TKmer& fwdmer, size_t pos, Emit& emit) { emit(kmer, pos); }
 
+    template <typename Emit>
+    void Finish(Emit& emit) {}
 };
 
+class MinimizerSeedPolicy
+{
+public:
+    MinimizerSeedPolicy() : numkmers(0), lastpos(std::numeric_limits<size_t>::max()) {}
+
+    template <typename Emit>
+    void operator()(const TKmer& kmer, const TKmer& fwdmer, size_t pos, Emit& emit)
+    {
+        /*
+         * The window is kept as a queue of the k-mers that can still become
+         * its minimizer, whose orders increase from front to back. Ties go to
+         * the leftmost k-mer.
+         */
+        Candidate candidate = {GetOrder(kmer), pos, kmer};
+
+        while (!window.empty() && window.back().order > candidate.order)
+            window.pop_back();
+
+        window.push_back(candidate);
+
+        if (window.front().pos + MINIMIZER_WINDOW <= pos)
+            window.pop_front();
+
+        if (++numkmers >= MINIMIZER_WINDOW)
+            EmitMinimizer(emit);
+    }
+
+    template <typename Emit>
+    void Finish(Emit& emit)
+    {
+        /*
+         * A read with fewer k-mers than a window still gets one seed.
+         */
+        if (numkmers && numkmers < MINIMIZER_WINDOW)
+            EmitMinimizer(emit);
+
+        window.clear();
+        numkmers = 0;
+        lastpos = std::numeric_limits<size_t>::max();
+    }
+
+private:
+    struct Candidate { uint64_t order; size_t pos; TKmer kmer; };
+
+    std::deque<Candidate> window;
+    size_t numkmers;
+    size_t lastpos; /* position of the last emitted minimizer */
+
+    /*
+     * The owner of a k-mer is decided by its hash, so the order is a
+     * rehash of it, or else the minimizers would all have the same owner.
+     */
+    static uint64_t GetOrder(const TKmer& kmer)
+    {
+        uint64_t hash = kmer.GetHash(), order;
+        wang_hash_64bits(&hash, &order);
+        return order;
+    }
+
+    template <typename Emit>
+    void EmitMinimizer(Emit& emit)
+    {
+        const Candidate& minimizer = window.front();
+
+        if (minimizer.pos != lastpos)
+        {
+            emit(minimizer.kmer, minimizer.pos);
+            lastpos = minimizer.pos;
+        }
+    }
+};
+
+class SyncmerSeedPolicy
+{
+public:
+    SyncmerSeedPolicy() : fwd(0), rev(0) {}
+
+    template <typename Emit>
+    void operator()(const TKmer& kmer, const TKmer& fwdmer, size_t pos, Emit& emit)
+    {
+        /*
+         * The s-mers are rolled along the read, one new base per k-mer, except
+         * for the first k-mer of the read, whose every base is new.
+         */
+        for (int i = pos? KMER_SIZE - 1 : 0; i < KMER_SIZE; ++i)
+            AddBase(fwdmer.GetNtCode(i), pos + i);
+
+        /*
+         * The window holds the s-mers of the k-mer at @pos, which are the ones
+         * at positions pos to pos + NUM_SMERS - 1.
+         */
+        if (window.front().pos < pos)
+            window.pop_front();
+
+        uint64_t minorder = window.front().order;
+
+        if (orders[pos % NUM_SMERS] == minorder || window.back().order == minorder)
+            emit(kmer, pos);
+    }
+
+    template <typename Emit>
+    void Finish(Emit& emit)
+    {
+        window.clear();
+        fwd = rev = 0;
+    }
+
+private:
+    static constexpr int NUM_SMERS = KMER_SIZE - SYNCMER_SIZE + 1; /* s-mers per k-mer */
+
+    struct Candidate { uint64_t order; size_t pos; };
+
+    /*
+     * Like the minimizer window, the s-mers that can still become the minimum
+     * of a k-mer are kept in a queue whose orders increase from front to back.
+     * The s-mers are compared by canonical form. The s-mers of the reverse
+     * complement are then the same ones in reverse order, so a k-mer and its
+     * twin are either both closed syncmers or neither are.
+     */
+    std::deque<Candidate> window;
+    uint64_t orders[NUM_SMERS]; /* order of the s-mer at position p in orders[p % NUM_SMERS] */
+    uint64_t fwd, rev;
+
+    void AddBase(uint64_t code, size_t i)
+    {
+        constexpr uint64_t mask = SYNCMER_SIZE == 32? ~0ULL : (1ULL << (2 * SYNCMER_SIZE)) - 1;
+
+        fwd = ((fwd << 2) | code) & mask;
+        rev = (rev >> 2) | ((3 - code) << (2 * (SYNCMER_SIZE - 1)));
+
+        if (i + 1 < SYNCMER_SIZE)
+            return;
+
+        uint64_t smer = std::min(fwd, rev), order;
+        wang_hash_64bits(&smer, &order);
+
+        Candidate candidate = {order, i + 1 - SYNCMER_SIZE};
+
+        while (!window.empty() && window.back().order > candidate.order)
+            window.pop_back();
+
+        window.push_back(candidate);
+        orders[candidate.pos % NUM_SMERS] = order;
+    }
+};
+
+#if SEED_POLICY == 1
+typedef MinimizerSeedPolicy SeedPolicy;
+#elif SEED_POLICY == 2
+static_assert(SYNCMER_SIZE > 0 && SYNCMER_SIZE < KMER_SIZE && SYNCMER_SIZE <= 32);
+typedef SyncmerSeedPolicy SeedPolicy;
+#else
+static_assert(SEED_POLICY == 0);
+typedef AllSeedPolicy SeedPolicy;
+#endif
+
 template <typename KmerHandler>
-void ForeachKmer(const Vector<String>& myreads, KmerHandler& handler)
+void ForeachKmer(const ReadStore& myreads, size_t first, size_t last, KmerHandler& handler)
 {
-    size_t i = 0;
+    SeedPolicy policy;
+
     /*
-     * Go through each local read.
+     * Go through each local read in [first, last).
      */
-    for (auto readitr = myreads.begin(); readitr != myreads.end(); ++readitr, ++i)
+    for (size_t i = first; i < last; ++i)
     {
+        size_t len = myreads.GetReadLength(i);
+
         /*
          * If it is too small then continue to the next one.
          */
-        if (readitr->size() < KMER_SIZE)
+        if (len < KMER_SIZE)
             continue;
 
         /*
-         * Get all the representative k-mer seeds.
+         * Go through each representative k-mer seed. The k-mers are
+         * generated on the fly, so nothing is allocated per read, and
+         * the seed policy decides which of them are passed on.
          */
-        Vector<TKmer> repmers = TKmer::GetRepKmers(*readitr);
+        auto emit = [&](const TKmer& seedmer, size_t j) { handler(seedmer, j, i); };
+        auto sample = [&](const TKmer& repmer, const TKmer& fwdmer, size_t j) { policy(repmer, fwdmer, j, emit); };
 
-        size_t j = 0;
+#if PACKED_READS == 1
+        TKmer::ForeachRepKmer(myreads.GetWords(), myreads.GetReadStart(i), len, sample);
+#else
+        TKmer::ForeachRepKmer(myreads[i].data(), len, sample);
+#endif
 
-        /*
-         * Go through each k-mer seed.
-         */
-        for (auto meritr = repmers.begin(); meritr != repmers.end(); ++meritr, ++j)
-        {
-            handler(*meritr, j, i);
-        }
+        policy.Finish(emit);
     }
 }
 
+template <typename KmerHandler>
+void ForeachKmer(const ReadStore& myreads, KmerHandler& handler)
+{
+    ForeachKmer(myreads, 0, myreads.size(), handler);
+}
+
+} /* namespace PIPELINE_NAMESPACE */
+
 #endif
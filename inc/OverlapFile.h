@@ -0,0 +1,49 @@
+#ifndef OVERLAP_FILE_H_
+#define OVERLAP_FILE_H_
+
+#include "common.h"
+
+/*
+ * OVERLAP_OUTPUT selects how B is written out:
+ *
+ *   0: Matrix Market text, to B.mtx (SpParMat::ParallelWriteMM);
+ *   1: binary columns, to B.bin (WriteOverlapFile);
+ *   2: binary columns compressed with zlib per processor, to B.bin.
+ */
+#ifndef OVERLAP_OUTPUT
+#define OVERLAP_OUTPUT 0
+#endif
+
+/*
+ * B.bin starts with this header. All the fields and arrays are little-endian,
+ * and the row and column ids are 0-based like the ones in B.mtx.
+ *
+ * Uncompressed, the header is followed by seven arrays of numnonzeros
+ * elements each (rows and cols as uint64, counts as uint32, and begQs[0],
+ * begTs[0], begQs[1] and begTs[1] as uint16), one after the other. Compressed,
+ * it is followed by numblocks pairs of uint64 (a block's number of nonzeros and
+ * its number of bytes), and then the blocks themselves, back to back. Each block
+ * is the zlib stream of the same seven arrays for the nonzeros of one processor.
+ */
+struct OverlapFileHeader
+{
+    char magic[8];         /* "ELBAOVL" */
+    uint32_t version;      /* 1 */
+    uint32_t compressed;   /* 1 if the arrays are compressed in blocks */
+    uint64_t numrows;
+    uint64_t numcols;
+    uint64_t numnonzeros;
+    uint64_t numblocks;    /* number of compressed blocks, 0 if uncompressed */
+};
+
+/*
+ * Writes @B to @fname in the format above, every processor its own tile, with
+ * collective MPI-IO. The value type must have ReadOverlap's count, begQs and
+ * begTs fields.
+ */
+template <class NT>
+void WriteOverlapFile(SpParMat<uint64_t, NT, SpDCCols<uint64_t, NT>>& B, const String& fname, bool compress);
+
+#include "OverlapFile.cpp"
+
+#endif
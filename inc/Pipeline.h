@@ -0,0 +1,63 @@
+#ifndef PIPELINE_H_
+#define PIPELINE_H_
+
+#include "common.h"
+
+/*
+ * The k-mer size and frequency bounds are compile-time constants of the
+ * pipeline, so that its hot loops are specialized for them. Instead of one
+ * binary per choice of them, the pipeline (src/RunPipeline.cpp) is compiled
+ * once for every configuration listed in the Makefile's PIPELINES, each in its
+ * own namespace, and every instance registers itself here at startup. main
+ * then runs the instance that the command line selects.
+ */
+struct PipelineConfig
+{
+    int kmersize;  /* KMER_SIZE */
+    int lowerfreq; /* LOWER_KMER_FREQ */
+    int upperfreq; /* UPPER_KMER_FREQ */
+    int usebloom;  /* USE_BLOOM */
+
+    /*
+     * Whether every field of @query that isn't negative equals the same field
+     * of this configuration.
+     */
+    bool Matches(const PipelineConfig& query) const;
+
+    bool operator<(const PipelineConfig& o) const;
+
+    String GetString() const;
+};
+
+/*
+ * What a pipeline instance runs on: the reads in @fasta_fname or, if
+ * @restart_fname isn't empty, the seed matrix checkpoint in it (see
+ * SeedCheckpoint.h). If @checkpoint_fname isn't empty, the seed matrix is
+ * also written to it, unless it is the checkpoint that was restarted from.
+ */
+struct PipelineArgs
+{
+    String fasta_fname;
+    String checkpoint_fname;
+    String restart_fname;
+};
+
+typedef void (*PipelineFunc)(const PipelineArgs& args, SharedPtr<CommGrid> commgrid);
+
+struct Pipeline
+{
+    PipelineConfig config;
+    PipelineFunc run;
+};
+
+/*
+ * The pipeline instances linked into the binary, sorted by configuration.
+ */
+Vector<Pipeline> GetPipelines();
+
+struct PipelineRegistrar
+{
+    PipelineRegistrar(const PipelineConfig& config, PipelineFunc run);
+};
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef PROFILER_H_
+#define PROFILER_H_
+
+#include "common.h"
+#include "Pipeline.h"
+
+/*
+ * The phases of the pipeline that are timed and whose communication is
+ * counted. Every processor keeps its own totals, which only WriteProfile
+ * reduces, so none of this synchronizes the processors. PROFILE_LOG is the
+ * time spent in LogAll (see Logger.h), which is also part of the time of
+ * the phase that logged.
+ */
+enum ProfilePhase
+{
+    PROFILE_TOTAL,
+    PROFILE_PARSE,      /* reading and distributing the reads */
+    PROFILE_HLL,        /* first pass over the reads and the cardinality estimate */
+    PROFILE_EXCHANGE1,  /* packing and sending the k-mers */
+    PROFILE_INSERT,     /* counting the received k-mers into the Bloom filter and kmermap */
+    PROFILE_EXCHANGE2,  /* packing, sending and adding the seeds */
+    PROFILE_MATRIX,     /* building A and AT */
+    PROFILE_SPGEMM,     /* B = A * AT */
+    PROFILE_WRITE,      /* writing B */
+    PROFILE_LOG,
+    NUM_PROFILE_PHASES
+};
+
+/*
+ * Adds the time from its construction to Stop (or to its destruction) to
+ * @phase, and records the peak resident set size so far.
+ */
+class PhaseTimer
+{
+public:
+    PhaseTimer(ProfilePhase phase);
+    ~PhaseTimer();
+
+    void Stop();
+
+private:
+    ProfilePhase phase;
+    double start;
+    bool running;
+};
+
+/*
+ * Counts one collective of @phase that sent @sentbytes and received
+ * @recvbytes on this processor.
+ */
+void ProfileCollective(ProfilePhase phase, uint64_t sentbytes, uint64_t recvbytes);
+
+/*
+ * Same for an all-to-all with the given per-processor counts of @typesize bytes.
+ */
+template <class Count>
+void ProfileAlltoall(ProfilePhase phase, const Vector<Count>& sendcnt, const Vector<Count>& recvcnt, size_t typesize = 1)
+{
+    uint64_t sentbytes = 0, recvbytes = 0;
+
+    for (size_t i = 0; i < sendcnt.size(); ++i)
+    {
+        sentbytes += sendcnt[i] * typesize;
+        recvbytes += recvcnt[i] * typesize;
+    }
+
+    ProfileCollective(phase, sentbytes, recvbytes);
+}
+
+/*
+ * Reduces the totals of every phase over all the processors, and writes
+ * their minimum, mean, maximum and imbalance (maximum over mean) to @fname
+ * as JSON, on the first processor.
+ */
+void WriteProfile(const String& fname, const PipelineConfig& config, SharedPtr<CommGrid> commgrid);
+
+#endif
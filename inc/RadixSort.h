@@ -0,0 +1,18 @@
+#ifndef RADIX_SORT_H_
+#define RADIX_SORT_H_
+
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * Sorts @numrecs fixed-width records of @recbytes bytes each, stored
+ * contiguously at @records, by their first @keywords 64-bit words
+ * (word 0 being the most significant one), using an LSD radix sort
+ * with 8-bit digits. The sort is stable, and digits that are the same
+ * in every record (e.g. the unused low bits of a k-mer) are skipped.
+ * With USE_OPENMP=1, every pass is split between the OpenMP threads.
+ * Needs a temporary buffer as large as the records themselves.
+ */
+void RadixSortRecords(uint8_t *records, size_t numrecs, size_t recbytes, int keywords);
+
+#endif
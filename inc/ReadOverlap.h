@@ -41,8 +41,8 @@ struct ReadOverlap
 
 struct OverlapHandler
 {
-    template <typename c, typename t>
-    void save(std::basic_ostream<c,t>& os, const ReadOverlap& o, uint64_t row, uint64_t col)
+    template <typename c, typename t, typename OVERLAP>
+    void save(std::basic_ostream<c,t>& os, const OVERLAP& o, uint64_t row, uint64_t col)
     {
         os << o;
     }
@@ -0,0 +1,62 @@
+#ifndef READ_STORE_H_
+#define READ_STORE_H_
+
+#include "common.h"
+#include <string_view>
+
+/*
+ * PACKED_READS == 1 keeps the reads at 2 bits per base instead of one byte.
+ * Bases other than A, C, G and T are packed as A, which is how the k-mer
+ * parser has always coded them, so the k-mers are the same in both modes.
+ * K-mers are then enumerated straight from the packed words (see
+ * Kmer::ForeachRepKmer).
+ */
+#ifndef PACKED_READS
+#define PACKED_READS 0
+#endif
+
+/*
+ * The local reads, stored back to back in one contiguous arena of bases
+ * (without newlines or separators), with the start of each read in an
+ * offsets array. Reads are handed out as string_views into the arena (or
+ * as packed bases with PACKED_READS), so holding all of them costs no
+ * per-read allocation.
+ */
+class ReadStore
+{
+public:
+    ReadStore() : offsets(1, 0) {}
+
+    /*
+     * Takes over @bases, which holds read i in [offsets[i], offsets[i+1]).
+     */
+    ReadStore(Vector<char>&& bases, Vector<size_t>&& offsets);
+
+    size_t size() const { return offsets.size() - 1; }
+    bool empty() const { return size() == 0; }
+
+    size_t GetReadLength(size_t i) const { return offsets[i+1] - offsets[i]; }
+    size_t GetTotalBases() const { return offsets.back(); }
+
+#if PACKED_READS == 1
+    /*
+     * Read i is made of bases [GetReadStart(i), GetReadStart(i+1)) of the packed words.
+     */
+    const uint64_t* GetWords() const { return words.data(); }
+    size_t GetReadStart(size_t i) const { return offsets[i]; }
+#else
+    static_assert(PACKED_READS == 0);
+
+    std::string_view operator[](size_t i) const { return std::string_view(bases.data() + offsets[i], GetReadLength(i)); }
+#endif
+
+private:
+#if PACKED_READS == 1
+    Vector<uint64_t> words;   /* 32 bases per word, the first one in the top 2 bits */
+#else
+    Vector<char> bases;
+#endif
+    Vector<size_t> offsets;   /* size() + 1 entries */
+};
+
+#endif
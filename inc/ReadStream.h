@@ -0,0 +1,39 @@
+#ifndef READ_STREAM_H_
+#define READ_STREAM_H_
+
+#include "common.h"
+#include "ReadStore.h"
+
+/*
+ * Streaming reader for the inputs that FastaIndex can't index: FASTQ (four
+ * lines per record), and BGZF-compressed (bgzip) FASTQ or FASTA. Every process
+ * reads one byte range of the file, or the BGZF blocks that start in it, and
+ * parses the records that start in it on the fly, reading past the end of its
+ * range to finish the last one. The reads end up in the same ReadStore as with
+ * FastaIndex::GetMyReads, in file order across the processes.
+ */
+class ReadStream
+{
+public:
+    ReadStream(const String& fname, SharedPtr<CommGrid> commgrid);
+
+    SharedPtr<CommGrid> getcommgrid() const { return commgrid; }
+    ReadStore GetMyReads();
+
+    /*
+     * Whether @fname should be read by a ReadStream instead of a FastaIndex,
+     * i.e. whether it is FASTQ or BGZF-compressed. Collective over @commgrid.
+     */
+    static bool IsStreamable(const String& fname, SharedPtr<CommGrid> commgrid);
+
+private:
+    enum Format { FASTA, FASTQ, BGZF_FASTA, BGZF_FASTQ };
+
+    SharedPtr<CommGrid> commgrid;
+    String fname;
+    Format format;
+
+    static Format GetFormat(const String& fname, SharedPtr<CommGrid> commgrid);
+};
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef SEED_CHECKPOINT_H_
+#define SEED_CHECKPOINT_H_
+
+#include "common.h"
+#include "KmerComm.h"
+
+inline namespace PIPELINE_NAMESPACE {
+
+/*
+ * A checkpoint of the seed matrix A, which is everything the pipeline
+ * computes from the reads, so that a run can restart from it (elba -r) and
+ * skip parsing the reads and both k-mer exchanges. The file doesn't depend on
+ * how A was distributed, and so can be read by any number of processors.
+ *
+ * It starts with this header, which is followed by three arrays of numnonzeros
+ * elements each: the row ids (read ids) and the column ids (k-mer ids) as
+ * uint64, and the positions as PosInRead, all little-endian. A checkpoint can
+ * only be read by a pipeline instance with the same parameters, in the
+ * sense of the fields below.
+ */
+struct SeedCheckpointHeader
+{
+    char magic[8];          /* "ELBASMX" */
+    uint32_t version;       /* 1 */
+    int32_t kmersize;       /* KMER_SIZE */
+    int32_t lowerfreq;      /* LOWER_KMER_FREQ */
+    int32_t upperfreq;      /* UPPER_KMER_FREQ */
+    int32_t usebloom;       /* USE_BLOOM */
+    int32_t seedpolicy;     /* SEED_POLICY */
+    int32_t seedwindow;     /* MINIMIZER_WINDOW or SYNCMER_SIZE, by SEED_POLICY */
+    uint32_t reserved;
+    uint64_t numrows;
+    uint64_t numcols;
+    uint64_t numnonzeros;
+};
+
+/*
+ * Writes @A to @fname, every processor its own tile, with collective MPI-IO.
+ */
+void SaveSeedMatrix(CT<PosInRead>::PSpParMat& A, const String& fname);
+
+/*
+ * Reads an equal share of the nonzeros of the checkpoint @fname into
+ * @rowids, @colids and @positions, and the dimensions of A into @numrows and
+ * @numcols.
+ */
+void LoadSeedMatrix(const String& fname, Vector<uint64_t>& rowids, Vector<uint64_t>& colids, Vector<PosInRead>& positions, uint64_t& numrows, uint64_t& numcols, SharedPtr<CommGrid> commgrid);
+
+} /* namespace PIPELINE_NAMESPACE */
+
+#endif
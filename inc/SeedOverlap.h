@@ -0,0 +1,123 @@
+#ifndef SEED_OVERLAP_H_
+#define SEED_OVERLAP_H_
+
+#include "KmerComm.h"
+#include <iostream>
+
+/*
+ * SLIM_OVERLAPS == 1 computes the overlap matrix B = A*AT with SeedOverlap
+ * values and the SeedIntersect semiring instead of ReadOverlap and
+ * KmerIntersect. B.mtx is the same either way.
+ */
+#ifndef SLIM_OVERLAPS
+#define SLIM_OVERLAPS 0
+#endif
+
+/*
+ * B only keeps the pairs of reads that share at least MIN_OVERLAP_SEEDS seeds.
+ * With OVERLAP_PHASES > 1, the columns of AT are multiplied in that many
+ * slices, and each slice of B is pruned before the next one is computed, so
+ * that at most one slice of B is ever held unpruned.
+ */
+#ifndef MIN_OVERLAP_SEEDS
+#define MIN_OVERLAP_SEEDS 2
+#endif
+
+#ifndef OVERLAP_PHASES
+#define OVERLAP_PHASES 1
+#endif
+
+static_assert(OVERLAP_PHASES >= 1);
+
+/*
+ * SYMMETRIC_OVERLAPS == 1 only keeps the entries (i,j) of B with i < j, since
+ * B is symmetric: the overlap (j,i) is (i,j) with the roles of the two reads
+ * swapped, i.e. with transpose set and begQs and begTs exchanged. Every kept
+ * entry is stored untransposed, with begQs in read i and begTs in read j.
+ * Each slice of columns is only multiplied by the rows of A above it, which
+ * skips most of the products below the diagonal, so it needs OVERLAP_PHASES
+ * > 1: with a single slice, all of B would be computed anyway.
+ */
+#ifndef SYMMETRIC_OVERLAPS
+#define SYMMETRIC_OVERLAPS 0
+#endif
+
+static_assert(SYMMETRIC_OVERLAPS == 0 || OVERLAP_PHASES > 1, "SYMMETRIC_OVERLAPS=1 needs OVERLAP_PHASES > 1");
+
+/*
+ * DIRECT_SEED_MATRIX == 1 sends the nonzeros of A from the k-mer owners
+ * straight to the processors that own their tiles of A, instead of building
+ * FullyDistVecs of the triples and then the matrix from them, which takes
+ * two exchanges. With SYMMETRIC_OVERLAPS, AT is built the same way.
+ */
+#ifndef DIRECT_SEED_MATRIX
+#define DIRECT_SEED_MATRIX 0
+#endif
+
+/*
+ * The fields of ReadOverlap that the multiply actually fills in: the number of
+ * seeds that two reads share, and the positions of the first two of them in
+ * both reads. 12 bytes and trivially copyable, where a ReadOverlap is over 100.
+ */
+struct SeedOverlap
+{
+    int count;
+    PosInRead begQs[2], begTs[2];
+
+    SeedOverlap() : count(0), begQs{0, 0}, begTs{0, 0} {}
+
+    friend std::ostream& operator<<(std::ostream& os, const SeedOverlap& o)
+    {
+        os << o.begQs[0] << "\t" << o.begTs[0] << "\t" << o.begQs[1] << "\t" << o.begTs[1];
+        return os;
+    }
+};
+
+struct SeedIntersect
+{
+    static SeedOverlap id() { return SeedOverlap(); }
+
+    static bool returnedSAID() { return false; }
+
+    static SeedOverlap add(const SeedOverlap& arg1, const SeedOverlap& arg2)
+    {
+        SeedOverlap res;
+
+        res.count = arg1.count + arg2.count;
+
+        res.begQs[0] = arg1.begQs[0];
+        res.begQs[1] = arg2.begQs[0];
+
+        res.begTs[0] = arg1.begTs[0];
+        res.begTs[1] = arg2.begTs[0];
+
+        return res;
+    }
+
+    static SeedOverlap multiply(const PosInRead& arg1, const PosInRead& arg2)
+    {
+        SeedOverlap a;
+
+        a.count = 1;
+        a.begQs[0] = arg1;
+        a.begTs[0] = arg2;
+
+        return a;
+    }
+
+    static void axpy(PosInRead a, const PosInRead& x, SeedOverlap& y)
+    {
+        y = add(y, multiply(a, x));
+    }
+};
+
+/*
+ * Used when the slices of B are summed up. They don't share any entries, so
+ * this is never actually called on two overlaps of the same pair of reads.
+ */
+inline SeedOverlap operator+(const SeedOverlap& a, const SeedOverlap& b)
+{
+    return SeedIntersect::add(a, b);
+}
+
+#endif
@@ -51,11 +51,16 @@ using MPI_Displ_type = int;
 
 #define MPI_ALLTOALL MPI_Alltoall
 #define MPI_ALLTOALLV MPI_Alltoallv
+#define MPI_ALLTOALLW MPI_Alltoallw
+#define MPI_IALLTOALLV MPI_Ialltoallv
 #define MPI_SCATTER MPI_Scatter
 #define MPI_SCATTERV MPI_Scatterv
 #define MPI_GATHER MPI_Gather
 #define MPI_GATHERV MPI_Gatherv
 #define MPI_FILE_READ_AT_ALL MPI_File_read_at_all
+#define MPI_FILE_READ_AT MPI_File_read_at
+#define MPI_FILE_WRITE_AT_ALL MPI_File_write_at_all
+#define MPI_TYPE_INDEXED MPI_Type_indexed
 
 #elif MPI_VERSION == 4
 #define MPI_HAS_LARGE_COUNTS 1
@@ -67,11 +72,16 @@ using MPI_Displ_type = MPI_Aint;
 
 #define MPI_ALLTOALL MPI_Alltoall_c
 #define MPI_ALLTOALLV MPI_Alltoallv_c
+#define MPI_ALLTOALLW MPI_Alltoallw_c
+#define MPI_IALLTOALLV MPI_Ialltoallv_c
 #define MPI_SCATTER MPI_Scatter_c
 #define MPI_SCATTERV MPI_Scatterv_c
 #define MPI_GATHER MPI_Gather_c
 #define MPI_GATHERV MPI_Gatherv_c
 #define MPI_FILE_READ_AT_ALL MPI_File_read_at_all_c
+#define MPI_FILE_READ_AT MPI_File_read_at_c
+#define MPI_FILE_WRITE_AT_ALL MPI_File_write_at_all_c
+#define MPI_TYPE_INDEXED MPI_Type_indexed_c
 
 #else
 #error "MPI version should either be 3 or 4."
@@ -0,0 +1,118 @@
+#!/usr/bin/env python3
+
+import sys
+import math
+import random
+import getopt
+
+base_for = "ACGT"
+base_rev = "TGCA"
+comp_tab = str.maketrans(base_for, base_rev)
+
+genome_size = 1000000
+coverage = 30.0
+error_rate = 0.01
+error_profile = (1.0, 1.0, 1.0)
+read_length = 10000
+read_length_sd = 2000
+min_read_length = 500
+seed = 1
+
+def usage():
+    sys.stderr.write("Usage: {} [options]\n".format(sys.argv[0]))
+    sys.stderr.write("    -g INT    genome size [{}]\n".format(genome_size))
+    sys.stderr.write("    -c FLOAT  coverage [{}]\n".format(coverage))
+    sys.stderr.write("    -e FLOAT  error rate per base [{}]\n".format(error_rate))
+    sys.stderr.write("    -p S,I,D  relative rates of substitutions, insertions and deletions [{},{},{}]\n".format(*error_profile))
+    sys.stderr.write("    -l INT    mean read length [{}]\n".format(read_length))
+    sys.stderr.write("    -d INT    standard deviation of the read length, 0 for fixed-length reads [{}]\n".format(read_length_sd))
+    sys.stderr.write("    -m INT    minimum read length [{}]\n".format(min_read_length))
+    sys.stderr.write("    -s INT    random seed [{}]\n".format(seed))
+    sys.stderr.write("    -o FILE   output FASTA, also indexed as FILE.fai [stdout]\n")
+    sys.stderr.write("    -h        help message\n")
+    sys.exit(1)
+
+def revcomp(s): return s.translate(comp_tab)[::-1]
+
+def sample_length(rng):
+    # lognormal with the requested mean and standard deviation, which has
+    # the long right tail of real long-read length distributions
+    if read_length_sd == 0: return read_length
+    sigma2 = math.log(1 + (read_length_sd / read_length) ** 2)
+    mu = math.log(read_length) - sigma2 / 2
+    return max(min_read_length, int(rng.lognormvariate(mu, math.sqrt(sigma2))))
+
+def add_errors(rng, seq):
+    # jumps from one error to the next instead of drawing for every base
+    if error_rate == 0: return seq
+    total = sum(error_profile)
+    pieces = []
+    i = 0
+    while True:
+        j = i + int(rng.expovariate(error_rate))
+        if j >= len(seq): break
+        pieces.append(seq[i:j])
+        r = rng.random() * total
+        if r < error_profile[0]:
+            pieces.append(rng.choice(base_for.replace(seq[j], "")))
+            i = j + 1
+        elif r < error_profile[0] + error_profile[1]:
+            pieces.append(rng.choice(base_for))
+            i = j
+        else:
+            i = j + 1
+    pieces.append(seq[i:])
+    return "".join(pieces)
+
+def main(argc, argv):
+    global genome_size, coverage, error_rate, error_profile, read_length, read_length_sd, min_read_length, seed
+    out_fname = None
+    try: opts, args = getopt.gnu_getopt(argv[1:], "g:c:e:p:l:d:m:s:o:h")
+    except getopt.GetoptError as err:
+        sys.stderr.write("error: {}\n".format(err))
+        sys.exit(1)
+    for o, a in opts:
+        if o == "-g": genome_size = int(a)
+        elif o == "-c": coverage = float(a)
+        elif o == "-e": error_rate = float(a)
+        elif o == "-p": error_profile = tuple(float(v) for v in a.split(","))
+        elif o == "-l": read_length = int(a)
+        elif o == "-d": read_length_sd = int(a)
+        elif o == "-m": min_read_length = int(a)
+        elif o == "-s": seed = int(a)
+        elif o == "-o": out_fname = a
+        elif o == "-h": usage()
+    if len(error_profile) != 3:
+        sys.stderr.write("error: -p takes three rates\n")
+        sys.exit(1)
+    rng = random.Random(seed)
+    genome = "".join(rng.choices(base_for, k=genome_size))
+    f = sys.stdout if out_fname is None else open(out_fname, "w")
+    fai = [] # samtools faidx records, every read is written on one line
+    offset = 0
+    bases = 0
+    idx = 0
+    while bases < coverage * genome_size:
+        l = min(sample_length(rng), genome_size)
+        pos = rng.randrange(genome_size - l + 1)
+        strand = rng.random() < 0.5
+        seq = genome[pos:pos+l]
+        if strand: seq = revcomp(seq)
+        seq = add_errors(rng, seq)
+        name = "read{}".format(idx)
+        header = ">{} pos={} len={} strand={}\n".format(name, pos, l, "-" if strand else "+")
+        f.write(header)
+        f.write(seq + "\n")
+        offset += len(header)
+        fai.append("{}\t{}\t{}\t{}\t{}\n".format(name, len(seq), offset, len(seq), len(seq) + 1))
+        offset += len(seq) + 1
+        bases += l
+        idx += 1
+    if not out_fname is None:
+        f.close()
+        with open(out_fname + ".fai", "w") as f:
+            f.writelines(fai)
+    sys.stderr.write("{} reads, {} bases, {:.2f}x coverage of a {} bp genome\n".format(idx, bases, bases / genome_size, genome_size))
+
+if __name__ == "__main__":
+    sys.exit(main(len(sys.argv), sys.argv))
@@ -0,0 +1,249 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <cstdlib>
+#include <functional>
+#include <algorithm>
+#include "common.h"
+#include "Kmer.h"
+#include "KmerComm.h"
+#include "Bloom.h"
+#include "BlockedBloom.h"
+#include "HyperLogLog.h"
+
+/*
+ * usage: elba-bench [-n NUM_KMERS] [-r REPEATS] [-s SEED] [BENCHMARK...]
+ *
+ * Microbenchmarks of the hot paths of the pipeline, built for the Makefile's
+ * K (and its mode parameters). The input is a random sequence drawn from
+ * SEED, so that runs are comparable across commits. Every benchmark is run
+ * REPEATS times and the fastest run is reported, in nanoseconds per k-mer.
+ * Only the benchmarks named on the command line are run, or all of them.
+ *
+ * The false positive rates of the Bloom filters are also measured, and the
+ * exit status is 1 if one of them is too far above the rate it was sized for.
+ */
+
+struct BenchmarkInput
+{
+    String sequence;           /* NUM_KMERS + KMER_SIZE - 1 random bases */
+    Vector<TKmer> kmers;       /* its k-mers */
+    Vector<TKmer> repmers;     /* their representatives */
+    Vector<uint64_t> hashes;   /* and the hashes of those */
+};
+
+/*
+ * Runs one repetition and returns the seconds spent in the timed part. The
+ * benchmark folds its results into @sink, so that they aren't optimized away.
+ */
+typedef std::function<double(const BenchmarkInput& input, uint64_t& sink)> BenchmarkFunc;
+
+struct Benchmark
+{
+    const char *name;
+    BenchmarkFunc run;
+};
+
+template <typename F>
+static double Time(F&& f)
+{
+    auto start = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static BenchmarkInput GetInput(size_t numkmers, uint64_t seed)
+{
+    BenchmarkInput input;
+    std::mt19937_64 rng(seed);
+
+    input.sequence.resize(numkmers + KMER_SIZE - 1);
+
+    for (char& c : input.sequence)
+        c = "ACGT"[rng() & 3];
+
+    input.kmers = TKmer::GetKmers(input.sequence);
+    input.repmers = TKmer::GetRepKmers(input.sequence);
+
+    input.hashes.reserve(numkmers);
+
+    for (const TKmer& repmer : input.repmers)
+        input.hashes.push_back(repmer.GetHash());
+
+    return input;
+}
+
+static Vector<Benchmark> GetBenchmarks()
+{
+    return
+    {
+        {"Kmer::GetRepKmers", [](const BenchmarkInput& input, uint64_t& sink)
+        {
+            return Time([&] { sink += TKmer::GetRepKmers(input.sequence).size(); });
+        }},
+
+        {"Kmer::GetTwin", [](const BenchmarkInput& input, uint64_t& sink)
+        {
+            return Time([&] { for (const TKmer& kmer : input.kmers) sink += kmer.GetTwin() < kmer; });
+        }},
+
+        {"Kmer::MakeRepKmers", [](const BenchmarkInput& input, uint64_t& sink)
+        {
+            Vector<TKmer> kmers(input.kmers);
+            double seconds = Time([&] { TKmer::MakeRepKmers(kmers.data(), kmers.size()); });
+            sink += kmers.back() == input.repmers.back();
+            return seconds;
+        }},
+
+        {"Kmer::GetHash", [](const BenchmarkInput& input, uint64_t& sink)
+        {
+            return Time([&] { for (const TKmer& repmer : input.repmers) sink += repmer.GetHash(); });
+        }},
+
+        {"Bloom::Add", [](const BenchmarkInput& input, uint64_t& sink)
+        {
+            Bloom bm(input.hashes.size(), 0.05);
+            return Time([&] { for (uint64_t hash : input.hashes) sink += bm.Add(hash); });
+        }},
+
+        {"Bloom::Check", [](const BenchmarkInput& input, uint64_t& sink)
+        {
+            Bloom bm(input.hashes.size(), 0.05);
+            for (size_t i = 0; i < input.hashes.size(); i += 2) bm.Add(input.hashes[i]);
+            return Time([&] { for (uint64_t hash : input.hashes) sink += bm.Check(hash); });
+        }},
+
+        {"BlockedBloom::TestAndSet", [](const BenchmarkInput& input, uint64_t& sink)
+        {
+            BlockedBloom bm(input.hashes.size(), 0.05);
+            return Time([&] { for (uint64_t hash : input.hashes) sink += bm.TestAndSet(hash); });
+        }},
+
+        {"BlockedBloom::Check", [](const BenchmarkInput& input, uint64_t& sink)
+        {
+            BlockedBloom bm(input.hashes.size(), 0.05);
+            for (size_t i = 0; i < input.hashes.size(); i += 2) bm.TestAndSet(input.hashes[i]);
+            return Time([&] { for (uint64_t hash : input.hashes) sink += bm.Check(hash); });
+        }},
+
+        {"HyperLogLog::Add", [](const BenchmarkInput& input, uint64_t& sink)
+        {
+            HyperLogLog hll(12);
+            double seconds = Time([&] { for (uint64_t hash : input.hashes) hll.Add(hash); });
+            sink += static_cast<uint64_t>(hll.Estimate());
+            return seconds;
+        }},
+
+        {"KmerCountMap::try_emplace", [](const BenchmarkInput& input, uint64_t& sink)
+        {
+            KmerCountMap kmermap;
+            kmermap.reserve(input.repmers.size());
+
+            return Time([&]
+            {
+                for (size_t i = 0; i < input.repmers.size(); ++i)
+                    sink += kmermap.try_emplace(input.repmers[i], input.hashes[i]).second;
+            });
+        }},
+
+        {"KmerCountMap::find", [](const BenchmarkInput& input, uint64_t& sink)
+        {
+            /*
+             * Half of the k-mers are in the map, so that hits and misses
+             * are both measured.
+             */
+            KmerCountMap kmermap;
+            kmermap.reserve(input.repmers.size() / 2);
+
+            for (size_t i = 0; i < input.repmers.size(); i += 2)
+                kmermap.try_emplace(input.repmers[i], input.hashes[i]);
+
+            return Time([&]
+            {
+                for (size_t i = 0; i < input.repmers.size(); ++i)
+                    sink += kmermap.find(input.repmers[i], input.hashes[i]) != kmermap.end();
+            });
+        }},
+    };
+}
+
+/*
+ * False positive rate of a @Filter sized for @error and filled with the first
+ * half of the hashes, measured on the second half (random k-mers are distinct,
+ * except with negligible probability).
+ */
+template <typename Filter>
+static double GetFalsePositiveRate(const BenchmarkInput& input, double error)
+{
+    size_t half = input.hashes.size() / 2;
+    size_t positives = 0;
+
+    Filter bm(std::max(static_cast<size_t>(1), half), error);
+
+    for (size_t i = 0; i < half; ++i)
+        bm.TestAndSet(input.hashes[i]);
+
+    for (size_t i = half; i < input.hashes.size(); ++i)
+        positives += bm.Check(input.hashes[i]);
+
+    return static_cast<double>(positives) / std::max(static_cast<size_t>(1), input.hashes.size() - half);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t numkmers = 1 << 22;
+    int repeats = 5;
+    uint64_t seed = 1;
+    Set<String> names;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        String arg(argv[i]);
+
+        if      (arg == "-n" && i+1 < argc) numkmers = std::strtoull(argv[++i], nullptr, 10);
+        else if (arg == "-r" && i+1 < argc) repeats  = std::atoi(argv[++i]);
+        else if (arg == "-s" && i+1 < argc) seed     = std::strtoull(argv[++i], nullptr, 10);
+        else names.insert(arg);
+    }
+
+    BenchmarkInput input = GetInput(numkmers, seed);
+    uint64_t sink = 0;
+
+    std::cout << "# -DKMER_SIZE=" << KMER_SIZE << " -DKMER_SIMD=" << KMER_SIMD << ", " << numkmers << " k-mers, best of " << repeats << "\n";
+    std::cout << "#benchmark\tns/kmer\tMkmers/s" << std::endl;
+
+    for (const Benchmark& benchmark : GetBenchmarks())
+    {
+        if (!names.empty() && !names.count(benchmark.name))
+            continue;
+
+        double best = 0;
+
+        for (int r = 0; r < repeats; ++r)
+        {
+            double seconds = benchmark.run(input, sink);
+            if (!r || seconds < best) best = seconds;
+        }
+
+        std::cout << benchmark.name << "\t" << std::fixed << std::setprecision(3) << (best * 1e9 / numkmers) << "\t" << (numkmers / best / 1e6) << std::endl;
+    }
+
+    std::cout << "# checksum " << sink << std::endl;
+
+    /*
+     * Sampling noise is far below the tolerance at the default NUM_KMERS.
+     */
+    constexpr double error = 0.05, tolerance = 1.2;
+    int status = 0;
+
+    for (auto [name, rate] : {std::make_pair("Bloom", GetFalsePositiveRate<Bloom>(input, error)),
+                              std::make_pair("BlockedBloom", GetFalsePositiveRate<BlockedBloom>(input, error))})
+    {
+        bool ok = rate <= error * tolerance;
+        std::cout << "# " << name << " false positive rate " << std::setprecision(4) << rate << " (sized for " << error << ")" << (ok? "" : " FAILED") << std::endl;
+        if (!ok) status = 1;
+    }
+
+    return status;
+}
@@ -0,0 +1,147 @@
+#include "BlockedBloom.h"
+#include "HashFuncs.h"
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+
+/*
+ * False positive rate of a filter whose blocks hold @load items on average.
+ * The loads of the blocks are Poisson distributed, and in a block with j
+ * items a probe bit of a word is set with probability 1 - (63/64)^j.
+ */
+static double GetFalsePositiveRate(double load)
+{
+    double rate = 0;
+    int maxload = static_cast<int>(load + 12 * std::sqrt(load) + 32);
+
+    for (int j = 0; j <= maxload; ++j)
+    {
+        double p = std::exp(-load + j * std::log(load) - std::lgamma(j + 1.0));
+        rate += p * std::pow(1 - std::pow(63.0 / 64.0, j), BlockedBloom::WORDS_PER_BLOCK);
+    }
+
+    return rate;
+}
+
+BlockedBloom::BlockedBloom(int64_t entries, double error) : entries(entries), error(error)
+{
+    assert(entries >= 1 && error > 0 && error < 1);
+
+    /*
+     * Every item sets one bit in each word of its block, so the number of
+     * probes is fixed, and the blocks are sized for that: the largest average
+     * load of a block (found by bisection) that keeps the false positive rate
+     * at most @error. At 5% that is about 7.0 bits per entry instead of the
+     * 6.2 of a classic Bloom filter with its optimal number of probes.
+     */
+    double lo = 0, hi = 1;
+
+    while (hi < 1e6 && GetFalsePositiveRate(hi) <= error)
+        hi *= 2;
+
+    for (int i = 0; i < 64; ++i)
+    {
+        double mid = (lo + hi) / 2;
+
+        if (GetFalsePositiveRate(mid) <= error)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    double load = std::max(lo, 1e-3);
+
+    blocks = std::max(static_cast<int64_t>(1), static_cast<int64_t>(std::ceil(static_cast<double>(entries) / load)));
+    hashes = WORDS_PER_BLOCK;
+
+    bf = new Block[blocks]();
+}
+
+BlockedBloom::~BlockedBloom()
+{
+    delete [] bf;
+}
+
+const BlockedBloom::Block& BlockedBloom::get_block(uint64_t h) const
+{
+    /*
+     * The top bits of a k-mer hash pick its owner processor, so all the items
+     * of one filter share them. The block and the pattern are picked from a
+     * remixed hash instead (see get_hash), the block by mapping its top 32
+     * bits onto [0, blocks).
+     */
+    return bf[((h >> 32) * static_cast<uint64_t>(blocks)) >> 32];
+}
+
+uint64_t BlockedBloom::get_hash(uint64_t hashval)
+{
+    uint64_t h;
+    wang_hash_64bits(&hashval, &h);
+    return h;
+}
+
+void BlockedBloom::get_pattern(uint64_t h, uint64_t *pattern)
+{
+    /*
+     * Split-block pattern: one bit in each of the 64-bit words, picked by the
+     * top 6 bits of the low 32 bits of the hash times an odd constant per word.
+     */
+    static constexpr uint32_t SALTS[WORDS_PER_BLOCK] =
+    {
+        0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+        0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U
+    };
+
+    uint32_t key = static_cast<uint32_t>(h);
+
+    for (int i = 0; i < WORDS_PER_BLOCK; ++i)
+        pattern[i] = static_cast<uint64_t>(1) << ((key * SALTS[i]) >> 26);
+}
+
+bool BlockedBloom::Check(uint64_t hashval) const
+{
+    uint64_t h = get_hash(hashval);
+    const Block& block = get_block(h);
+
+    uint64_t pattern[WORDS_PER_BLOCK];
+    get_pattern(h, pattern);
+
+    uint64_t missing = 0;
+
+    for (int i = 0; i < WORDS_PER_BLOCK; ++i)
+        missing |= pattern[i] & ~block.words[i];
+
+    return !missing;
+}
+
+bool BlockedBloom::TestAndSet(uint64_t hashval)
+{
+    uint64_t h = get_hash(hashval);
+    Block& block = const_cast<Block&>(get_block(h));
+
+    uint64_t pattern[WORDS_PER_BLOCK];
+    get_pattern(h, pattern);
+
+    uint64_t missing = 0;
+
+    /*
+     * Most items that get here are already in the filter, so test before
+     * writing to keep the block from being dirtied (and bounced between
+     * cores) for nothing.
+     */
+    for (int i = 0; i < WORDS_PER_BLOCK; ++i)
+        missing |= pattern[i] & ~__atomic_load_n(&block.words[i], __ATOMIC_RELAXED);
+
+    if (!missing)
+        return true;
+
+    missing = 0;
+
+    for (int i = 0; i < WORDS_PER_BLOCK; ++i)
+    {
+        uint64_t old = __atomic_fetch_or(&block.words[i], pattern[i], __ATOMIC_RELAXED);
+        missing |= pattern[i] & ~old;
+    }
+
+    return !missing;
+}
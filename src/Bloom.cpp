@@ -41,17 +41,37 @@ bool Bloom::Add(const void *buffer, size_t len)
     return bloom_check_add(buffer, len, true);
 }
 
-bool Bloom::bloom_check_add(const void *buffer, size_t len, bool add)
+bool Bloom::Check(uint64_t hashval)
 {
-    assert(ready);
+    uint64_t b;
+    wang_hash_64bits(&hashval, &b);
+    return bloom_check_add(hashval, b, false);
+}
 
-    int hits = 0;
+bool Bloom::Add(uint64_t hashval)
+{
+    uint64_t b;
+    wang_hash_64bits(&hashval, &b);
+    return bloom_check_add(hashval, b, true);
+}
+
+bool Bloom::bloom_check_add(const void *buffer, size_t len, bool add)
+{
     uint32_t a1 = murmurhash3(buffer, len, 0x9747b28c);
     uint32_t a2 = murmurhash3(buffer, len, a1);
     uint32_t b1 = murmurhash3(buffer, len, a2);
     uint32_t b2 = murmurhash3(buffer, len, b1);
     uint64_t a = (((uint64_t)a1)<<32) | ((uint64_t)a2);
     uint64_t b = (((uint64_t)b1)<<32) | ((uint64_t)b2);
+
+    return bloom_check_add(a, b, add);
+}
+
+bool Bloom::bloom_check_add(uint64_t a, uint64_t b, bool add)
+{
+    assert(ready);
+
+    int hits = 0;
     uint64_t x;
     uint64_t byte;
     uint32_t mask;
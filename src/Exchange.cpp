@@ -0,0 +1,235 @@
+#include "Exchange.h"
+#include <iostream>
+#include <cassert>
+#include <numeric>
+
+#if HIERARCHICAL_EXCHANGE == 1
+static void PrefixSum(const Vector<MPI_Count_type>& counts, Vector<MPI_Displ_type>& displs)
+{
+    displs.resize(counts.size());
+    displs.front() = 0;
+    std::partial_sum(counts.begin(), counts.end()-1, displs.begin()+1);
+}
+
+/*
+ * The byte counts of the two stages: @sendcnt1[j] and @recvcnt1[j] are what
+ * goes to and comes from the relay (myrow, j), and @sendcnt2[i] and
+ * @recvcnt2[i] what goes to and comes from processor (i, mycol) through it.
+ */
+static void GetStageCounts(const Vector<MPI_Count_type>& sendcnt, const Vector<MPI_Count_type>& recvcnt, const Vector<MPI_Count_type>& relayed,
+                           Vector<MPI_Count_type>& sendcnt1, Vector<MPI_Count_type>& recvcnt1,
+                           Vector<MPI_Count_type>& sendcnt2, Vector<MPI_Count_type>& recvcnt2, SharedPtr<CommGrid> commgrid)
+{
+    int r = commgrid->GetGridRows();
+    int c = commgrid->GetGridCols();
+
+    sendcnt1.assign(c, 0);
+    recvcnt1.assign(c, 0);
+    sendcnt2.assign(r, 0);
+    recvcnt2.assign(r, 0);
+
+    for (int i = 0; i < r; ++i)
+        for (int j = 0; j < c; ++j)
+        {
+            sendcnt1[j] += sendcnt[i*c + j];
+            recvcnt1[j] += relayed[j*r + i];
+            sendcnt2[i] += relayed[j*r + i];
+            recvcnt2[i] += recvcnt[i*c + j];
+        }
+}
+
+#if MPI_HAS_LARGE_COUNTS == 0
+/*
+ * The counts of every stage are sums of several of the per-processor counts,
+ * which can overflow the int counts of MPI 3 where the flat exchange doesn't.
+ */
+static void CheckStageCounts(const Vector<MPI_Count_type>& sendcnt, const Vector<MPI_Count_type>& recvcnt, const Vector<MPI_Count_type>& relayed, SharedPtr<CommGrid> commgrid)
+{
+    int r = commgrid->GetGridRows();
+    int c = commgrid->GetGridCols();
+
+    uint64_t maxcount = std::numeric_limits<MPI_Count_type>::max();
+    uint64_t relaybytes = 0; /* also bounds sendcnt2, recvcnt1 and the displacements into the relay buffer */
+    bool overflow = false;
+
+    for (int k = 0; k < r*c; ++k)
+        relaybytes += relayed[k];
+
+    for (int j = 0; j < c; ++j)
+    {
+        uint64_t sendbytes = 0;
+
+        for (int i = 0; i < r; ++i)
+            sendbytes += sendcnt[i*c + j];
+
+        overflow = overflow || sendbytes > maxcount;
+    }
+
+    for (int i = 0; i < r; ++i)
+    {
+        uint64_t recvbytes = 0;
+
+        for (int j = 0; j < c; ++j)
+            recvbytes += recvcnt[i*c + j];
+
+        overflow = overflow || recvbytes > maxcount;
+    }
+
+    if (overflow || relaybytes > maxcount)
+    {
+        std::cerr << "processor " << commgrid->GetRank() << " moves more than " << maxcount << " bytes in one stage of the hierarchical exchange, "
+                  << "which needs -DHIERARCHICAL_EXCHANGE=0 or MPI 4" << std::endl;
+        MPI_Abort(commgrid->GetWorld(), 1);
+    }
+}
+#else
+static_assert(MPI_HAS_LARGE_COUNTS == 1);
+#endif
+#else
+static_assert(HIERARCHICAL_EXCHANGE == 0);
+#endif
+
+void GetSendDispls(const Vector<MPI_Count_type>& sendcnt, Vector<MPI_Displ_type>& sdispls, SharedPtr<CommGrid> commgrid)
+{
+    sdispls.resize(sendcnt.size());
+
+#if HIERARCHICAL_EXCHANGE == 1
+    int r = commgrid->GetGridRows();
+    int c = commgrid->GetGridCols();
+
+    MPI_Displ_type displ = 0;
+
+    for (int j = 0; j < c; ++j)
+        for (int i = 0; i < r; ++i)
+        {
+            sdispls[i*c + j] = displ;
+            displ += sendcnt[i*c + j];
+        }
+#else
+    sdispls.front() = 0;
+    std::partial_sum(sendcnt.begin(), sendcnt.end()-1, sdispls.begin()+1);
+#endif
+}
+
+void ExchangeCounts(const Vector<MPI_Count_type>& sendcnt, Vector<MPI_Count_type>& recvcnt, ExchangePlan& plan, SharedPtr<CommGrid> commgrid)
+{
+#if HIERARCHICAL_EXCHANGE == 1
+    int r = commgrid->GetGridRows();
+    int c = commgrid->GetGridCols();
+
+    /*
+     * First stage: plan.relayed[l*r + i] becomes the number of bytes that
+     * processor (myrow, l) sends to processor (i, mycol) through this one.
+     */
+    Vector<MPI_Count_type> bycolumn(r*c); /* bycolumn[j*r + i] is sendcnt of (i,j), grouped by the relay (myrow, j) */
+
+    for (int i = 0; i < r; ++i)
+        for (int j = 0; j < c; ++j)
+            bycolumn[j*r + i] = sendcnt[i*c + j];
+
+    plan.relayed.resize(r*c);
+
+    MPI_ALLTOALL(bycolumn.data(), r, MPI_COUNT_TYPE, plan.relayed.data(), r, MPI_COUNT_TYPE, commgrid->GetRowWorld());
+    ProfileCollective(plan.phase, r * c * sizeof(MPI_Count_type), r * c * sizeof(MPI_Count_type));
+
+    /*
+     * Second stage: the counts for processor (i, mycol) go to it, ordered by
+     * their source column, so that it receives them in the order of the
+     * source ranks.
+     */
+    Vector<MPI_Count_type> byrow(r*c);
+
+    for (int i = 0; i < r; ++i)
+        for (int l = 0; l < c; ++l)
+            byrow[i*c + l] = plan.relayed[l*r + i];
+
+    MPI_ALLTOALL(byrow.data(), c, MPI_COUNT_TYPE, recvcnt.data(), c, MPI_COUNT_TYPE, commgrid->GetColWorld());
+    ProfileCollective(plan.phase, r * c * sizeof(MPI_Count_type), r * c * sizeof(MPI_Count_type));
+
+#if MPI_HAS_LARGE_COUNTS == 0
+    CheckStageCounts(sendcnt, recvcnt, plan.relayed, commgrid);
+#endif
+#else
+    int nprocs = commgrid->GetSize();
+
+    MPI_ALLTOALL(sendcnt.data(), 1, MPI_COUNT_TYPE, recvcnt.data(), 1, MPI_COUNT_TYPE, commgrid->GetWorld());
+    ProfileCollective(plan.phase, nprocs * sizeof(MPI_Count_type), nprocs * sizeof(MPI_Count_type));
+#endif
+}
+
+void ExchangeBytes(const uint8_t *sendbuf, const Vector<MPI_Count_type>& sendcnt, const Vector<MPI_Displ_type>& sdispls,
+                   uint8_t *recvbuf, const Vector<MPI_Count_type>& recvcnt, const Vector<MPI_Displ_type>& rdispls,
+                   const ExchangePlan& plan, SharedPtr<CommGrid> commgrid)
+{
+#if HIERARCHICAL_EXCHANGE == 1
+    int r = commgrid->GetGridRows();
+    int c = commgrid->GetGridCols();
+
+    const Vector<MPI_Count_type>& relayed = plan.relayed;
+
+    Vector<MPI_Count_type> sendcnt1, recvcnt1, sendcnt2, recvcnt2;
+    GetStageCounts(sendcnt, recvcnt, relayed, sendcnt1, recvcnt1, sendcnt2, recvcnt2, commgrid);
+
+    /*
+     * First stage: the data for all the processors of column j goes to the
+     * relay (myrow, j), ordered by destination row, which is how GetSendDispls
+     * laid out sendbuf.
+     */
+    Vector<MPI_Displ_type> sdispls1(c), rdispls1;
+
+    for (int j = 0; j < c; ++j)
+    {
+        sdispls1[j] = sdispls[j];
+
+        for (int i = 1; i < r; ++i)
+            assert(sdispls[i*c + j] == sdispls[(i-1)*c + j] + sendcnt[(i-1)*c + j]);
+    }
+
+    PrefixSum(recvcnt1, rdispls1);
+
+    Vector<uint8_t> relaybuf(rdispls1.back() + recvcnt1.back());
+
+    MPI_ALLTOALLV(sendbuf, sendcnt1.data(), sdispls1.data(), MPI_BYTE, relaybuf.data(), recvcnt1.data(), rdispls1.data(), MPI_BYTE, commgrid->GetRowWorld());
+    ProfileAlltoall(plan.phase, sendcnt1, recvcnt1);
+
+    /*
+     * Second stage: relaybuf holds, for every source column l and destination
+     * row i, relayed[l*r + i] bytes for processor (i, mycol). Each processor
+     * of the column is sent its c pieces with one indexed datatype, in the
+     * order of their source column, so that every processor receives its data
+     * in the order of the source ranks, which is the layout of recvbuf.
+     */
+    Vector<MPI_Count_type> relaydispls(r*c);
+    std::exclusive_scan(relayed.begin(), relayed.end(), relaydispls.begin(), static_cast<MPI_Count_type>(0));
+
+    Vector<MPI_Datatype> sendtypes(r), recvtypes(r, MPI_BYTE);
+    Vector<MPI_Count_type> typecnts(r, 1), blocklens(c), blockdispls(c);
+    Vector<MPI_Displ_type> sdispls2(r, 0), rdispls2(r);
+
+    for (int i = 0; i < r; ++i)
+    {
+        for (int l = 0; l < c; ++l)
+        {
+            blocklens[l] = relayed[l*r + i];
+            blockdispls[l] = relaydispls[l*r + i];
+        }
+
+        MPI_TYPE_INDEXED(c, blocklens.data(), blockdispls.data(), MPI_BYTE, &sendtypes[i]);
+        MPI_Type_commit(&sendtypes[i]);
+
+        rdispls2[i] = rdispls[i*c];
+    }
+
+    for (int k = 1; k < r*c; ++k)
+        assert(rdispls[k] == rdispls[k-1] + recvcnt[k-1]);
+
+    MPI_ALLTOALLW(relaybuf.data(), typecnts.data(), sdispls2.data(), sendtypes.data(), recvbuf, recvcnt2.data(), rdispls2.data(), recvtypes.data(), commgrid->GetColWorld());
+    ProfileAlltoall(plan.phase, sendcnt2, recvcnt2);
+
+    for (int i = 0; i < r; ++i)
+        MPI_Type_free(&sendtypes[i]);
+#else
+    MPI_ALLTOALLV(sendbuf, sendcnt.data(), sdispls.data(), MPI_BYTE, recvbuf, recvcnt.data(), rdispls.data(), MPI_BYTE, commgrid->GetWorld());
+    ProfileAlltoall(plan.phase, sendcnt, recvcnt);
+#endif
+}
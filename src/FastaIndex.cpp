@@ -1,5 +1,8 @@
 #include "FastaIndex.h"
+#include "Profiler.h"
 #include <cstring>
+#include <cstdlib>
+#include <cctype>
 #include <iterator>
 #include <algorithm>
 #include <numeric>
@@ -16,11 +19,340 @@ faidx_record_t GetFaidxRecord(const String& line, Vector<String>& names)
     return record;
 }
 
+/*
+ * Process that record @i of @numrecords goes to, where @basesbefore is the
+ * total length of the records before it and @totbases that of all records.
+ */
+static int GetRecordOwner(size_t i, size_t numrecords, size_t basesbefore, size_t totbases, int nprocs)
+{
+#if BALANCED_READS == 1
+    /*
+     * Process p gets the records that start in the p-th nprocs'th of all the
+     * bases. A record longer than a whole share leaves the processes whose
+     * share it covers without records.
+     */
+    if (!totbases) return nprocs-1;
+
+    return static_cast<int>(std::min(static_cast<size_t>(nprocs-1), basesbefore * nprocs / totbases));
+#else
+    static_assert(BALANCED_READS == 0);
+
+    /*
+     * Every process gets numrecords/nprocs records, and the last one also
+     * gets the remainder.
+     */
+    size_t records_per_proc = numrecords / nprocs;
+
+    return records_per_proc? static_cast<int>(std::min(static_cast<size_t>(nprocs-1), i / records_per_proc)) : nprocs-1;
+#endif
+}
+
+static MPI_Datatype GetFaidxType()
+{
+    MPI_Datatype faidx_dtype_t;
+    MPI_Type_contiguous(3, MPI_SIZE_T, &faidx_dtype_t);
+    MPI_Type_commit(&faidx_dtype_t);
+    return faidx_dtype_t;
+}
+
+#if PARALLEL_FAIDX == 1
+static constexpr MPI_Offset FAIDX_BLOCK_BYTES = 64 * 1024 * 1024; /* the FASTA file is scanned in blocks of this size */
+static constexpr MPI_Offset LINE_READ_BYTES = 4096;               /* bytes read at a time to finish a line */
+
+/*
+ * Reads the lines of @fh (of size @filesize) that start in [begin, end) into
+ * @buf, each ending with a newline, and returns the file offset of the first
+ * one. The last line is read up to its newline even if that is past @end,
+ * so every line of the file is read by exactly one of the ranges that
+ * partition it.
+ */
+static MPI_Offset ReadLines(MPI_File fh, MPI_Offset filesize, MPI_Offset begin, MPI_Offset end, Vector<char>& buf)
+{
+    buf.clear();
+    end = std::min(end, filesize);
+
+    if (begin >= end) return end;
+
+    /*
+     * The byte before @begin tells whether a line starts at @begin.
+     */
+    MPI_Offset readbegin = begin? begin-1 : 0;
+
+    buf.resize(end - readbegin);
+    MPI_FILE_READ_AT(fh, readbegin, buf.data(), buf.size(), MPI_CHAR, MPI_STATUS_IGNORE);
+
+    size_t first = 0;
+
+    if (begin)
+    {
+        first = std::find(buf.begin(), buf.end(), '\n') - buf.begin() + 1;
+
+        if (first >= buf.size()) /* no line starts in [begin, end) */
+        {
+            buf.clear();
+            return end;
+        }
+    }
+
+    for (MPI_Offset pos = end; buf.back() != '\n' && pos < filesize; pos += LINE_READ_BYTES)
+    {
+        size_t oldsize = buf.size();
+
+        buf.resize(oldsize + std::min(LINE_READ_BYTES, filesize - pos));
+        MPI_FILE_READ_AT(fh, pos, buf.data() + oldsize, buf.size() - oldsize, MPI_CHAR, MPI_STATUS_IGNORE);
+
+        auto newline = std::find(buf.begin() + oldsize, buf.end(), '\n');
+
+        if (newline != buf.end())
+            buf.erase(newline + 1, buf.end());
+    }
+
+    if (buf.back() != '\n') /* last line of a file without a final newline */
+        buf.push_back('\n');
+
+    buf.erase(buf.begin(), buf.begin() + first);
+
+    return readbegin + first;
+}
+
+/*
+ * Reads this process's records of the index @faidx_fname in parallel.
+ * Returns false if the file can't be opened.
+ */
+static bool ReadFaidx(const String& faidx_fname, Vector<faidx_record_t>& myrecords, SharedPtr<CommGrid> commgrid)
+{
+    int nprocs = commgrid->GetSize();
+    int myrank = commgrid->GetRank();
+
+    MPI_File fh;
+
+    if (MPI_File_open(commgrid->GetWorld(), faidx_fname.c_str(), MPI_MODE_RDONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS)
+        return false;
+
+    MPI_Offset filesize;
+    MPI_File_get_size(fh, &filesize);
+
+    Vector<char> buf;
+    ReadLines(fh, filesize, (filesize * myrank) / nprocs, (filesize * (myrank+1)) / nprocs, buf);
+
+    MPI_File_close(&fh);
+
+    /*
+     * Each line is "name len pos bases bytes", separated by tabs.
+     */
+    for (auto itr = buf.cbegin(); itr != buf.cend(); )
+    {
+        auto newline = std::find(itr, buf.cend(), '\n');
+        auto tab = std::find(itr, newline, '\t');
+
+        if (tab != newline)
+        {
+            faidx_record_t record;
+            char *next;
+
+            record.len = std::strtoull(&*tab + 1, &next, 10);
+            record.pos = std::strtoull(next, &next, 10);
+            record.bases = std::strtoull(next, &next, 10);
+
+            myrecords.push_back(record);
+        }
+
+        itr = newline + 1;
+    }
+
+    return true;
+}
+
+/*
+ * Builds this process's part of the index of the FASTA file @fasta_fname, in
+ * file order: the records whose header line starts in this process's byte
+ * range. Also tries to write the whole index to @faidx_fname.
+ */
+static void IndexFasta(const String& fasta_fname, const String& faidx_fname, Vector<faidx_record_t>& myrecords, SharedPtr<CommGrid> commgrid)
+{
+    int nprocs = commgrid->GetSize();
+    int myrank = commgrid->GetRank();
+
+    MPI_File fh;
+
+    if (MPI_File_open(commgrid->GetWorld(), fasta_fname.c_str(), MPI_MODE_RDONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS)
+    {
+        if (!myrank) std::cerr << "could not open " << fasta_fname << std::endl;
+        MPI_Abort(commgrid->GetWorld(), 1);
+    }
+
+    MPI_Offset filesize;
+    MPI_File_get_size(fh, &filesize);
+
+    MPI_Offset mybegin = (filesize * myrank) / nprocs;
+    MPI_Offset myend = (filesize * (myrank+1)) / nprocs;
+
+    Vector<String> mynames;
+    Vector<char> buf;
+
+    /*
+     * Sequence lines before this process's first header belong to a record
+     * of an earlier process: the number of bases in them, and the length
+     * of the first one in case the record has no sequence line before them.
+     */
+    size_t leading[3] = {0, 0, 0}; /* leading bases, first leading line length, whether this process has a header */
+
+    for (MPI_Offset begin = mybegin; begin < myend; begin += FAIDX_BLOCK_BYTES)
+    {
+        MPI_Offset offset = ReadLines(fh, filesize, begin, std::min(begin + FAIDX_BLOCK_BYTES, myend), buf);
+
+        for (auto itr = buf.cbegin(); itr != buf.cend(); )
+        {
+            auto newline = std::find(itr, buf.cend(), '\n');
+            size_t linelen = newline - itr;
+
+            if (*itr == '>')
+            {
+                faidx_record_t record;
+
+                record.len = record.bases = 0;
+                record.pos = offset + (newline - buf.cbegin()) + 1;
+
+                mynames.emplace_back(itr + 1, std::find_if(itr + 1, newline, [](char c) { return std::isspace(c); }));
+                myrecords.push_back(record);
+            }
+            else if (linelen)
+            {
+                size_t& len = myrecords.empty()? leading[0] : myrecords.back().len;
+                size_t& bases = myrecords.empty()? leading[1] : myrecords.back().bases;
+
+                len += linelen;
+                if (!bases) bases = linelen;
+            }
+
+            itr = newline + 1;
+        }
+    }
+
+    MPI_File_close(&fh);
+
+    leading[2] = !myrecords.empty();
+
+    Vector<size_t> allleading(3 * nprocs);
+    MPI_Allgather(leading, 3, MPI_SIZE_T, allleading.data(), 3, MPI_SIZE_T, commgrid->GetWorld());
+
+    /*
+     * The last local record continues into the leading lines of the next
+     * processes, up to the first one that has a header.
+     */
+    if (!myrecords.empty())
+    {
+        faidx_record_t& record = myrecords.back();
+
+        for (int i = myrank+1; i < nprocs; ++i)
+        {
+            record.len += allleading[3*i];
+            if (!record.bases) record.bases = allleading[3*i+1];
+            if (allleading[3*i+2]) break;
+        }
+    }
+
+    /*
+     * Write out the index, every process its own lines.
+     */
+    std::ostringstream ss;
+
+    for (size_t i = 0; i < myrecords.size(); ++i)
+    {
+        const faidx_record_t& record = myrecords[i];
+        ss << mynames[i] << "\t" << record.len << "\t" << record.pos << "\t" << record.bases << "\t" << record.bases + 1 << "\n";
+    }
+
+    String mylines = ss.str();
+    MPI_Offset mysize = mylines.size(), myoffset = 0;
+
+    MPI_Exscan(&mysize, &myoffset, 1, MPI_OFFSET, MPI_SUM, commgrid->GetWorld());
+    if (!myrank) myoffset = 0;
+
+    if (MPI_File_open(commgrid->GetWorld(), faidx_fname.c_str(), MPI_MODE_WRONLY | MPI_MODE_CREATE, MPI_INFO_NULL, &fh) == MPI_SUCCESS)
+    {
+        MPI_File_set_size(fh, 0);
+        MPI_FILE_WRITE_AT_ALL(fh, myoffset, mylines.data(), mylines.size(), MPI_CHAR, MPI_STATUS_IGNORE);
+        MPI_File_close(&fh);
+    }
+    else if (!myrank)
+    {
+        std::cerr << "could not write index " << faidx_fname << ", it will be built again on the next run" << std::endl;
+    }
+}
+
+/*
+ * Sends the records in @myrecords, which are this process's contiguous part
+ * of the whole index, to the processes that own them (see GetRecordOwner).
+ */
+static Vector<faidx_record_t> DistributeRecords(const Vector<faidx_record_t>& myrecords, SharedPtr<CommGrid> commgrid)
+{
+    int nprocs = commgrid->GetSize();
+    int myrank = commgrid->GetRank();
+
+    size_t mynumrecords = myrecords.size();
+    size_t mybases = std::accumulate(myrecords.begin(), myrecords.end(), static_cast<size_t>(0), [](size_t cur, const faidx_record_t& rec) { return cur + rec.len; });
+
+    size_t myfirst = 0, basesbefore = 0, numrecords, totbases;
+
+    MPI_Exscan(&mynumrecords, &myfirst, 1, MPI_SIZE_T, MPI_SUM, commgrid->GetWorld());
+    MPI_Exscan(&mybases, &basesbefore, 1, MPI_SIZE_T, MPI_SUM, commgrid->GetWorld());
+
+    if (!myrank) myfirst = basesbefore = 0;
+
+    MPI_Allreduce(&mynumrecords, &numrecords, 1, MPI_SIZE_T, MPI_SUM, commgrid->GetWorld());
+    MPI_Allreduce(&mybases, &totbases, 1, MPI_SIZE_T, MPI_SUM, commgrid->GetWorld());
+
+    /*
+     * Owners never decrease along the index, so the records
+     * are already grouped by destination.
+     */
+    Vector<MPI_Count_type> sendcnt(nprocs, 0), recvcnt(nprocs);
+    Vector<MPI_Displ_type> sdispls(nprocs), rdispls(nprocs);
+
+    for (size_t i = 0; i < mynumrecords; ++i)
+    {
+        sendcnt[GetRecordOwner(myfirst + i, numrecords, basesbefore, totbases, nprocs)]++;
+        basesbefore += myrecords[i].len;
+    }
+
+    MPI_ALLTOALL(sendcnt.data(), 1, MPI_COUNT_TYPE, recvcnt.data(), 1, MPI_COUNT_TYPE, commgrid->GetWorld());
+    ProfileCollective(PROFILE_PARSE, nprocs * sizeof(MPI_Count_type), nprocs * sizeof(MPI_Count_type));
+
+    sdispls.front() = rdispls.front() = 0;
+
+    std::partial_sum(sendcnt.begin(), sendcnt.end()-1, sdispls.begin()+1);
+    std::partial_sum(recvcnt.begin(), recvcnt.end()-1, rdispls.begin()+1);
+
+    Vector<faidx_record_t> records(rdispls.back() + recvcnt.back());
+
+    MPI_Datatype faidx_dtype_t = GetFaidxType();
+    MPI_ALLTOALLV(myrecords.data(), sendcnt.data(), sdispls.data(), faidx_dtype_t, records.data(), recvcnt.data(), rdispls.data(), faidx_dtype_t, commgrid->GetWorld());
+    ProfileAlltoall(PROFILE_PARSE, sendcnt, recvcnt, sizeof(faidx_record_t));
+    MPI_Type_free(&faidx_dtype_t);
+
+    return records;
+}
+#else
+static_assert(PARALLEL_FAIDX == 0);
+#endif
+
 FastaIndex::FastaIndex(const String& fasta_fname, SharedPtr<CommGrid> commgrid) : commgrid(commgrid), fasta_fname(fasta_fname)
 {
     int nprocs = commgrid->GetSize();
     int myrank = commgrid->GetRank();
 
+#if PARALLEL_FAIDX == 1
+    Vector<faidx_record_t> myrecords; /* records whose lines start in this process's byte range of the index */
+
+    if (!ReadFaidx(GetFaidxFilename(), myrecords, commgrid))
+    {
+        if (!myrank) std::cerr << "no index " << GetFaidxFilename() << " found, building it" << std::endl;
+        IndexFasta(fasta_fname, GetFaidxFilename(), myrecords, commgrid);
+    }
+
+    records = DistributeRecords(myrecords, commgrid);
+#else
     Vector<MPI_Count_type> sendcounts; /* MPI_Scatterv sendcounts for faidx_record_t records (root only) */
     Vector<MPI_Displ_type> displs;     /* MPI_Scatterv displs for faidx_record_t records (root only)     */
     MPI_Count_type recvcount;          /* MPI_Scatterv recvcount for faidx_record_t records              */
@@ -47,11 +379,14 @@ FastaIndex::FastaIndex(const String& fasta_fname, SharedPtr<CommGrid> commgrid)
 
         displs.front() = 0;
 
-        MPI_Count_type records_per_proc = num_records / nprocs;
+        size_t totbases = std::accumulate(root_records.begin(), root_records.end(), static_cast<size_t>(0), [](size_t cur, const faidx_record_t& rec) { return cur + rec.len; });
+        size_t basesbefore = 0;
 
-        std::fill_n(sendcounts.begin(), nprocs-1, records_per_proc);
-
-        sendcounts.back() = num_records - (nprocs-1) * records_per_proc;
+        for (MPI_Count_type i = 0; i < num_records; ++i)
+        {
+            sendcounts[GetRecordOwner(i, num_records, basesbefore, totbases, nprocs)]++;
+            basesbefore += root_records[i].len;
+        }
 
         std::partial_sum(sendcounts.begin(), sendcounts.end()-1, displs.begin()+1);
     }
@@ -63,27 +398,31 @@ FastaIndex::FastaIndex(const String& fasta_fname, SharedPtr<CommGrid> commgrid)
 
     records.resize(recvcount);
 
-    MPI_Datatype faidx_dtype_t;
-    MPI_Type_contiguous(3, MPI_SIZE_T, &faidx_dtype_t);
-    MPI_Type_commit(&faidx_dtype_t);
+    MPI_Datatype faidx_dtype_t = GetFaidxType();
     MPI_SCATTERV(root_records.data(), sendcounts.data(), displs.data(), faidx_dtype_t, records.data(), recvcount, faidx_dtype_t, 0, commgrid->GetWorld());
     MPI_Type_free(&faidx_dtype_t);
+#endif
 }
 
-Vector<String> FastaIndex::GetMyReads()
+ReadStore FastaIndex::GetMyReads()
 {
-    Vector<String> reads;
-
     const Vector<faidx_record_t>& records = getrecords();
     size_t num_records = records.size();
 
-    reads.reserve(num_records);
+    /*
+     * A process can be left without records (see BALANCED_READS), but
+     * it still has to take part in the collective read.
+     */
+    MPI_Offset startpos = 0, endpos = 0;
 
-    const faidx_record_t& first_record = records.front();
-    const faidx_record_t& last_record = records.back();
+    if (num_records)
+    {
+        const faidx_record_t& first_record = records.front();
+        const faidx_record_t& last_record = records.back();
 
-    MPI_Offset startpos = first_record.pos;
-    MPI_Offset endpos = last_record.pos + last_record.len + (last_record.len / last_record.bases);
+        startpos = first_record.pos;
+        endpos = last_record.pos + last_record.len + (last_record.bases? last_record.len / last_record.bases : 0);
+    }
 
     MPI_File fh;
     MPI_File_open(commgrid->GetWorld(), fasta_fname.c_str(), MPI_MODE_RDONLY, MPI_INFO_NULL, &fh);
@@ -91,7 +430,7 @@ Vector<String> FastaIndex::GetMyReads()
     MPI_Offset filesize;
     MPI_File_get_size(fh, &filesize);
 
-    endpos = std::max(endpos, filesize);
+    endpos = std::min(endpos, filesize);
 
     MPI_Count_type mychunksize = endpos - startpos;
 
@@ -100,36 +439,37 @@ Vector<String> FastaIndex::GetMyReads()
     MPI_FILE_READ_AT_ALL(fh, startpos, mychunk.data(), mychunksize, MPI_CHAR, MPI_STATUS_IGNORE);
     MPI_File_close(&fh);
 
-    size_t maxlen, offset = 0;
-
-    MPI_Exscan(&num_records, &offset, 1, MPI_SIZE_T, MPI_SUM, commgrid->GetWorld());
-
-    maxlen = std::accumulate(records.begin(), records.end(), 0, [](size_t l, const faidx_record_t& rec) { return l > rec.len? l : rec.len; });
+    /*
+     * Strip the headers and newlines by moving the bases of every read
+     * to the front of the chunk, which then becomes the read arena. The
+     * bases only ever move towards the front, so this is done in place.
+     */
+    Vector<size_t> offsets(num_records + 1);
+    char *bufptr = mychunk.data();
 
-    char *seqbuf = new char[maxlen];
+    offsets.front() = 0;
 
-    for (auto itr = records.cbegin(); itr != records.cend(); ++itr)
+    for (size_t i = 0; i < num_records; ++i)
     {
+        const faidx_record_t& record = records[i];
+
         size_t locpos = 0;
-        ptrdiff_t chunkpos = itr->pos - startpos;
-        ptrdiff_t remain = itr->len;
-        char *bufptr = seqbuf;
+        ptrdiff_t chunkpos = record.pos - startpos;
+        ptrdiff_t remain = record.len;
 
         while (remain > 0)
         {
-            size_t cnt = std::min(itr->bases, static_cast<size_t>(remain));
-            std::memcpy(bufptr, &mychunk.data()[chunkpos + locpos], cnt);
+            size_t cnt = std::min(record.bases, static_cast<size_t>(remain));
+            std::memmove(bufptr, &mychunk.data()[chunkpos + locpos], cnt);
             bufptr += cnt;
             remain -= cnt;
             locpos += (cnt+1);
         }
 
-        reads.emplace_back(seqbuf, itr->len);
+        offsets[i+1] = bufptr - mychunk.data();
     }
 
-    delete[] seqbuf;
-
-    return reads;
+    return ReadStore(std::move(mychunk), std::move(offsets));
 }
 
 void FastaIndex::PrintInfo() const
@@ -0,0 +1,218 @@
+#include "FlatHashMap.h"
+#include <algorithm>
+
+template <class K, class V, class H>
+size_t FlatHashMap<K,V,H>::probe(const K& key, uint64_t hash) const
+{
+    /*
+     * Returns the slot holding @key, or ctrl.size() if @key isn't in the table.
+     */
+
+    size_t numslots = ctrl.size();
+
+    if (!numslots) return numslots;
+
+    size_t mask = numslots - 1;
+    size_t slot = hash & mask;
+    uint8_t tag = get_tag(hash);
+
+    while (ctrl[slot] != EMPTY)
+    {
+        if (ctrl[slot] == tag && keys[slot] == key)
+            return slot;
+
+        slot = (slot + 1) & mask;
+    }
+
+    return numslots;
+}
+
+template <class K, class V, class H>
+typename FlatHashMap<K,V,H>::iterator FlatHashMap<K,V,H>::find(const K& key, uint64_t hash)
+{
+    size_t slot = probe(key, hash);
+    return slot == ctrl.size()? end() : iterator(this, index[slot]);
+}
+
+template <class K, class V, class H>
+typename FlatHashMap<K,V,H>::const_iterator FlatHashMap<K,V,H>::find(const K& key, uint64_t hash) const
+{
+    size_t slot = probe(key, hash);
+    return slot == ctrl.size()? cend() : const_iterator(this, index[slot]);
+}
+
+template <class K, class V, class H>
+std::pair<typename FlatHashMap<K,V,H>::iterator, bool> FlatHashMap<K,V,H>::try_emplace(const K& key, uint64_t hash)
+{
+    /*
+     * Make sure there is room for one more used slot before probing,
+     * so that the probe sequence always ends at an empty slot.
+     */
+    if ((numused + 1) * MAX_LOAD_DEN > ctrl.size() * MAX_LOAD_NUM)
+    {
+        /*
+         * Only grow the table if most used slots hold live keys,
+         * otherwise rehashing in place clears out the tombstones.
+         */
+        size_t numslots = std::max(static_cast<size_t>(16), ctrl.size());
+        rehash((numlive + 1) * 2 * MAX_LOAD_DEN > numslots * MAX_LOAD_NUM? numslots * 2 : numslots);
+    }
+
+    size_t mask = ctrl.size() - 1;
+    size_t slot = hash & mask;
+    size_t freeslot = ctrl.size();
+    uint8_t tag = get_tag(hash);
+
+    while (ctrl[slot] != EMPTY)
+    {
+        if (ctrl[slot] == tag && keys[slot] == key)
+            return {iterator(this, index[slot]), false};
+
+        if (ctrl[slot] == TOMBSTONE && freeslot == ctrl.size())
+            freeslot = slot;
+
+        slot = (slot + 1) & mask;
+    }
+
+    if (freeslot == ctrl.size())
+    {
+        freeslot = slot;
+        numused++;
+    }
+
+    assert(values.size() < ERASED);
+
+    ctrl[freeslot] = tag;
+    keys[freeslot] = key;
+    index[freeslot] = static_cast<uint32_t>(values.size());
+
+    values.emplace_back();
+    slots.push_back(static_cast<uint32_t>(freeslot));
+
+    numlive++;
+
+    return {iterator(this, values.size()-1), true};
+}
+
+template <class K, class V, class H>
+typename FlatHashMap<K,V,H>::iterator FlatHashMap<K,V,H>::erase(const_iterator pos)
+{
+    size_t i = pos.pos;
+    size_t slot = slots[i];
+    size_t mask = ctrl.size() - 1;
+
+    assert(slot != ERASED);
+
+    /*
+     * If the next slot is empty then no probe sequence runs
+     * through this slot, so it can be emptied rather than
+     * left as a tombstone.
+     */
+    if (ctrl[(slot + 1) & mask] == EMPTY)
+    {
+        ctrl[slot] = EMPTY;
+        numused--;
+    }
+    else
+    {
+        ctrl[slot] = TOMBSTONE;
+    }
+
+    values[i] = V();
+    slots[i] = ERASED;
+    numlive--;
+
+    return iterator(this, i);
+}
+
+template <class K, class V, class H>
+template <typename Predicate>
+size_t FlatHashMap<K,V,H>::erase_if(Predicate pred)
+{
+    size_t numerased = 0;
+
+    for (auto itr = begin(); itr != end(); ++itr)
+    {
+        if (pred(*itr))
+        {
+            erase(itr);
+            numerased++;
+        }
+    }
+
+    /*
+     * Compact the dense arrays, keeping the live entries in
+     * their original order.
+     */
+    size_t j = 0;
+
+    for (size_t i = 0; i < values.size(); ++i)
+    {
+        if (slots[i] == ERASED)
+            continue;
+
+        if (i != j)
+        {
+            values[j] = std::move(values[i]);
+            slots[j] = slots[i];
+        }
+
+        index[slots[j]] = static_cast<uint32_t>(j);
+        j++;
+    }
+
+    values.resize(j);
+    slots.resize(j);
+    values.shrink_to_fit();
+    slots.shrink_to_fit();
+
+    return numerased;
+}
+
+template <class K, class V, class H>
+void FlatHashMap<K,V,H>::reserve(size_t n)
+{
+    size_t numslots = 16;
+
+    while (numslots * MAX_LOAD_NUM < n * MAX_LOAD_DEN)
+        numslots <<= 1;
+
+    if (numslots > ctrl.size())
+        rehash(numslots);
+}
+
+template <class K, class V, class H>
+void FlatHashMap<K,V,H>::rehash(size_t numslots)
+{
+    assert(numslots > 0 && !(numslots & (numslots - 1)));
+
+    Vector<uint8_t> newctrl(numslots, EMPTY);
+    Vector<K> newkeys(numslots);
+    Vector<uint32_t> newindex(numslots);
+
+    size_t mask = numslots - 1;
+
+    for (size_t i = 0; i < slots.size(); ++i)
+    {
+        if (slots[i] == ERASED)
+            continue;
+
+        const K& key = keys[slots[i]];
+        uint64_t hash = H()(key);
+        size_t slot = hash & mask;
+
+        while (newctrl[slot] != EMPTY)
+            slot = (slot + 1) & mask;
+
+        newctrl[slot] = get_tag(hash);
+        newkeys[slot] = key;
+        newindex[slot] = static_cast<uint32_t>(i);
+        slots[i] = static_cast<uint32_t>(slot);
+    }
+
+    ctrl.swap(newctrl);
+    keys.swap(newkeys);
+    index.swap(newindex);
+
+    numused = numlive;
+}
@@ -41,7 +41,11 @@ void HyperLogLog::Add(char const *s, size_t len)
 {
     uint64_t hashval;
     murmurhash3_64bits(s, len, &hashval);
+    Add(hashval);
+}
 
+void HyperLogLog::Add(uint64_t hashval)
+{
     uint32_t index = hashval >> (HASHBITS - bits);
     uint8_t rank = rho((hashval << bits), HASHBITS - bits);
 
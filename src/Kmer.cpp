@@ -5,6 +5,16 @@
 #include <algorithm>
 #include <limits>
 
+#if KMER_SIMD == 1 || KMER_SIMD == 2
+#include <immintrin.h>
+#elif KMER_SIMD == 3
+#include <arm_neon.h>
+#else
+static_assert(KMER_SIMD == 0);
+#endif
+
+inline namespace PIPELINE_NAMESPACE {
+
 static uint8_t get_nt_code(const char c)
 {
     static const uint8_t nt_lookup_code[256] =
@@ -30,30 +40,225 @@ static uint8_t get_nt_code(const char c)
     return nt_lookup_code[static_cast<int>(c)];
 }
 
-static uint64_t get_tetramer_revcomp_code(const uint8_t code)
-{
-    static const uint8_t tetramer_lookup_code[256] =
-    {
-        0xff,0xbf,0x7f,0x3f,0xef,0xaf,0x6f,0x2f,0xdf,0x9f,0x5f,0x1f,0xcf,0x8f,0x4f,0xf,
-        0xfb,0xbb,0x7b,0x3b,0xeb,0xab,0x6b,0x2b,0xdb,0x9b,0x5b,0x1b,0xcb,0x8b,0x4b,0xb,
-        0xf7,0xb7,0x77,0x37,0xe7,0xa7,0x67,0x27,0xd7,0x97,0x57,0x17,0xc7,0x87,0x47,0x7,
-        0xf3,0xb3,0x73,0x33,0xe3,0xa3,0x63,0x23,0xd3,0x93,0x53,0x13,0xc3,0x83,0x43,0x3,
-        0xfe,0xbe,0x7e,0x3e,0xee,0xae,0x6e,0x2e,0xde,0x9e,0x5e,0x1e,0xce,0x8e,0x4e,0xe,
-        0xfa,0xba,0x7a,0x3a,0xea,0xaa,0x6a,0x2a,0xda,0x9a,0x5a,0x1a,0xca,0x8a,0x4a,0xa,
-        0xf6,0xb6,0x76,0x36,0xe6,0xa6,0x66,0x26,0xd6,0x96,0x56,0x16,0xc6,0x86,0x46,0x6,
-        0xf2,0xb2,0x72,0x32,0xe2,0xa2,0x62,0x22,0xd2,0x92,0x52,0x12,0xc2,0x82,0x42,0x2,
-        0xfd,0xbd,0x7d,0x3d,0xed,0xad,0x6d,0x2d,0xdd,0x9d,0x5d,0x1d,0xcd,0x8d,0x4d,0xd,
-        0xf9,0xb9,0x79,0x39,0xe9,0xa9,0x69,0x29,0xd9,0x99,0x59,0x19,0xc9,0x89,0x49,0x9,
-        0xf5,0xb5,0x75,0x35,0xe5,0xa5,0x65,0x25,0xd5,0x95,0x55,0x15,0xc5,0x85,0x45,0x5,
-        0xf1,0xb1,0x71,0x31,0xe1,0xa1,0x61,0x21,0xd1,0x91,0x51,0x11,0xc1,0x81,0x41,0x1,
-        0xfc,0xbc,0x7c,0x3c,0xec,0xac,0x6c,0x2c,0xdc,0x9c,0x5c,0x1c,0xcc,0x8c,0x4c,0xc,
-        0xf8,0xb8,0x78,0x38,0xe8,0xa8,0x68,0x28,0xd8,0x98,0x58,0x18,0xc8,0x88,0x48,0x8,
-        0xf4,0xb4,0x74,0x34,0xe4,0xa4,0x64,0x24,0xd4,0x94,0x54,0x14,0xc4,0x84,0x44,0x4,
-        0xf0,0xb0,0x70,0x30,0xe0,0xa0,0x60,0x20,0xd0,0x90,0x50,0x10,0xc0,0x80,0x40,0x0
-    };
+static inline uint64_t get_word_revcomp(uint64_t word)
+{
+    /*
+     * The reverse complement of the 32 bases packed into @word. Flipping both
+     * bits of a base complements it, and the order of the bases is reversed
+     * by reversing the bytes and then the nibbles and 2-bit groups of each byte.
+     */
+    word = __builtin_bswap64(~word);
+    word = ((word >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((word & 0x0F0F0F0F0F0F0F0FULL) << 4);
+    word = ((word >> 2) & 0x3333333333333333ULL) | ((word & 0x3333333333333333ULL) << 2);
+    return word;
+}
+
+#if KMER_SIMD == 1
+/*
+ * The operations that make_rep_kmers_simd needs, on vectors holding the same
+ * word of LANES consecutive k-mers, which are STRIDE words apart in memory.
+ */
+struct KmerSimdOps
+{
+    typedef __m256i Vec;
+    typedef __m256i Mask;
+
+    static constexpr int LANES = 4;
+
+    template <int STRIDE>
+    static Vec load(const uint64_t *p)
+    {
+        if constexpr (STRIDE == 1) return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        else return _mm256_set_epi64x(p[3*STRIDE], p[2*STRIDE], p[STRIDE], p[0]);
+    }
+
+    template <int STRIDE>
+    static void store(uint64_t *p, Vec v)
+    {
+        if constexpr (STRIDE == 1) _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v);
+        else
+        {
+            alignas(32) uint64_t words[LANES];
+            _mm256_store_si256(reinterpret_cast<__m256i*>(words), v);
+            for (int i = 0; i < LANES; ++i) p[i*STRIDE] = words[i];
+        }
+    }
+
+    static Vec revcomp(Vec v)
+    {
+        const Vec bytes = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+                                           7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+        const Vec nibbles = _mm256_set1_epi8(0x0F);
+        const Vec pairs = _mm256_set1_epi8(0x33);
+
+        v = _mm256_shuffle_epi8(_mm256_xor_si256(v, _mm256_set1_epi64x(-1)), bytes);
+        v = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi64(v, 4), nibbles), _mm256_slli_epi64(_mm256_and_si256(v, nibbles), 4));
+        v = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi64(v, 2), pairs), _mm256_slli_epi64(_mm256_and_si256(v, pairs), 2));
+        return v;
+    }
+
+    static Vec shl(Vec v, int n) { return _mm256_sll_epi64(v, _mm_cvtsi32_si128(n)); }
+    static Vec shr(Vec v, int n) { return _mm256_srl_epi64(v, _mm_cvtsi32_si128(n)); }
+    static Vec vor(Vec a, Vec b) { return _mm256_or_si256(a, b); }
+
+    /*
+     * AVX2 only compares signed words, so both sides are offset by 2^63.
+     */
+    static Mask lt(Vec a, Vec b)
+    {
+        const Vec sign = _mm256_set1_epi64x(std::numeric_limits<int64_t>::min());
+        return _mm256_cmpgt_epi64(_mm256_xor_si256(b, sign), _mm256_xor_si256(a, sign));
+    }
+
+    static Mask eq(Vec a, Vec b) { return _mm256_cmpeq_epi64(a, b); }
+    static Mask mand(Mask a, Mask b) { return _mm256_and_si256(a, b); }
+    static Mask mor(Mask a, Mask b) { return _mm256_or_si256(a, b); }
+    static Vec select(Mask m, Vec a, Vec b) { return _mm256_blendv_epi8(b, a, m); }
+};
+#elif KMER_SIMD == 2
+struct KmerSimdOps
+{
+    typedef __m512i Vec;
+    typedef __mmask8 Mask;
+
+    static constexpr int LANES = 8;
+
+    template <int STRIDE>
+    static Vec get_index() { return _mm512_setr_epi64(0, STRIDE, 2*STRIDE, 3*STRIDE, 4*STRIDE, 5*STRIDE, 6*STRIDE, 7*STRIDE); }
+
+    template <int STRIDE>
+    static Vec load(const uint64_t *p)
+    {
+        if constexpr (STRIDE == 1) return _mm512_loadu_si512(p);
+        else return _mm512_i64gather_epi64(get_index<STRIDE>(), p, 8);
+    }
+
+    template <int STRIDE>
+    static void store(uint64_t *p, Vec v)
+    {
+        if constexpr (STRIDE == 1) _mm512_storeu_si512(p, v);
+        else _mm512_i64scatter_epi64(p, get_index<STRIDE>(), v, 8);
+    }
+
+    static Vec revcomp(Vec v)
+    {
+        const Vec bytes = _mm512_set4_epi32(0x08090a0b, 0x0c0d0e0f, 0x00010203, 0x04050607);
+        const Vec nibbles = _mm512_set1_epi8(0x0F);
+        const Vec pairs = _mm512_set1_epi8(0x33);
+
+        v = _mm512_shuffle_epi8(_mm512_xor_si512(v, _mm512_set1_epi64(-1)), bytes);
+        v = _mm512_or_si512(_mm512_and_si512(_mm512_srli_epi64(v, 4), nibbles), _mm512_slli_epi64(_mm512_and_si512(v, nibbles), 4));
+        v = _mm512_or_si512(_mm512_and_si512(_mm512_srli_epi64(v, 2), pairs), _mm512_slli_epi64(_mm512_and_si512(v, pairs), 2));
+        return v;
+    }
+
+    static Vec shl(Vec v, int n) { return _mm512_sll_epi64(v, _mm_cvtsi32_si128(n)); }
+    static Vec shr(Vec v, int n) { return _mm512_srl_epi64(v, _mm_cvtsi32_si128(n)); }
+    static Vec vor(Vec a, Vec b) { return _mm512_or_si512(a, b); }
+
+    static Mask lt(Vec a, Vec b) { return _mm512_cmplt_epu64_mask(a, b); }
+    static Mask eq(Vec a, Vec b) { return _mm512_cmpeq_epu64_mask(a, b); }
+    static Mask mand(Mask a, Mask b) { return a & b; }
+    static Mask mor(Mask a, Mask b) { return a | b; }
+    static Vec select(Mask m, Vec a, Vec b) { return _mm512_mask_blend_epi64(m, b, a); }
+};
+#elif KMER_SIMD == 3
+struct KmerSimdOps
+{
+    typedef uint64x2_t Vec;
+    typedef uint64x2_t Mask;
 
-    return static_cast<uint64_t>(tetramer_lookup_code[code]);
+    static constexpr int LANES = 2;
+
+    template <int STRIDE>
+    static Vec load(const uint64_t *p)
+    {
+        if constexpr (STRIDE == 1) return vld1q_u64(p);
+        else return vcombine_u64(vld1_u64(p), vld1_u64(p + STRIDE));
+    }
+
+    template <int STRIDE>
+    static void store(uint64_t *p, Vec v)
+    {
+        if constexpr (STRIDE == 1) vst1q_u64(p, v);
+        else
+        {
+            vst1_u64(p, vget_low_u64(v));
+            vst1_u64(p + STRIDE, vget_high_u64(v));
+        }
+    }
+
+    static Vec revcomp(Vec v)
+    {
+        const Vec nibbles = vdupq_n_u64(0x0F0F0F0F0F0F0F0FULL);
+        const Vec pairs = vdupq_n_u64(0x3333333333333333ULL);
+
+        v = vreinterpretq_u64_u8(vrev64q_u8(vmvnq_u8(vreinterpretq_u8_u64(v))));
+        v = vorrq_u64(vandq_u64(vshrq_n_u64(v, 4), nibbles), vshlq_n_u64(vandq_u64(v, nibbles), 4));
+        v = vorrq_u64(vandq_u64(vshrq_n_u64(v, 2), pairs), vshlq_n_u64(vandq_u64(v, pairs), 2));
+        return v;
+    }
+
+    static Vec shl(Vec v, int n) { return vshlq_u64(v, vdupq_n_s64(n)); }
+    static Vec shr(Vec v, int n) { return vshlq_u64(v, vdupq_n_s64(-n)); }
+    static Vec vor(Vec a, Vec b) { return vorrq_u64(a, b); }
+
+    static Mask lt(Vec a, Vec b) { return vcltq_u64(a, b); }
+    static Mask eq(Vec a, Vec b) { return vceqq_u64(a, b); }
+    static Mask mand(Mask a, Mask b) { return vandq_u64(a, b); }
+    static Mask mor(Mask a, Mask b) { return vorrq_u64(a, b); }
+    static Vec select(Mask m, Vec a, Vec b) { return vbslq_u64(m, a, b); }
+};
+#endif
+
+#if KMER_SIMD != 0
+template <class Ops, int N_LONGS>
+static size_t make_rep_kmers_simd(uint64_t *words, size_t count)
+{
+    /*
+     * The same steps as Kmer::GetTwin and Kmer::GetRep, on Ops::LANES k-mers
+     * at a time: vector l holds word l of each of them. Returns the number of
+     * k-mers done, the rest are left to the scalar code.
+     */
+    typedef typename Ops::Vec Vec;
+    typedef typename Ops::Mask Mask;
+
+    constexpr int shift = 2 * (32 - (KMER_SIZE % 32));
+
+    size_t i;
+
+    for (i = 0; i + Ops::LANES <= count; i += Ops::LANES)
+    {
+        uint64_t *p = words + i * N_LONGS;
+        Vec fwd[N_LONGS], twin[N_LONGS];
+
+        for (int l = 0; l < N_LONGS; ++l)
+        {
+            fwd[l] = Ops::template load<N_LONGS>(p + l);
+            twin[N_LONGS-1-l] = Ops::revcomp(fwd[l]);
+        }
+
+        for (int l = 0; l < N_LONGS-1; ++l)
+            twin[l] = Ops::vor(Ops::shl(twin[l], shift), Ops::shr(twin[l+1], 64 - shift));
+
+        twin[N_LONGS-1] = Ops::shl(twin[N_LONGS-1], shift);
+
+        Mask less = Ops::lt(twin[0], fwd[0]);
+        Mask equal = Ops::eq(twin[0], fwd[0]);
+
+        for (int l = 1; l < N_LONGS; ++l)
+        {
+            less = Ops::mor(less, Ops::mand(equal, Ops::lt(twin[l], fwd[l])));
+            equal = Ops::mand(equal, Ops::eq(twin[l], fwd[l]));
+        }
+
+        for (int l = 0; l < N_LONGS; ++l)
+            Ops::template store<N_LONGS>(p + l, Ops::select(less, twin[l], fwd[l]));
+    }
+
+    return i;
 }
+#endif
 
 template <int N_LONGS>
 Kmer<N_LONGS>::Kmer() : longs{} {}
@@ -155,18 +360,8 @@ bool Kmer<N_LONGS>::operator!=(const Kmer& o) const
 template <int N_LONGS>
 Kmer<N_LONGS> Kmer<N_LONGS>::GetExtension(char const nt) const
 {
-    Kmer ext;
-
-    ext.longs[0] = longs[0] << 2;
-
-    for (uint64_t i = 1; i < N_LONGS; ++i)
-    {
-        ext.longs[i-1] |= ((longs[i] >> 62) & 0x3);
-        ext.longs[i] = longs[i] << 2;
-    }
-
-    ext.longs[N_LONGS-1] |= (static_cast<uint64_t>(get_nt_code(nt)) << (2 * (32 - (KMER_SIZE%32))));
-
+    Kmer ext(*this);
+    ext.roll_forward(static_cast<uint64_t>(get_nt_code(nt) & 3));
     return ext;
 }
 
@@ -175,30 +370,19 @@ Kmer<N_LONGS> Kmer<N_LONGS>::GetTwin() const
 {
     Kmer twin;
 
-    /* unroll */
     for (int l = 0; l < N_LONGS; ++l)
-    {
-        uint64_t longmer = longs[l];
-
-        /* unroll */
-        for (uint64_t i = 0; i < 64; i += 8)
-        {
-            uint8_t bytemer = (longmer >> i) & 0xff;
-            uint64_t revcomp_bytemer = get_tetramer_revcomp_code(bytemer);
-            twin.longs[N_LONGS-1-l] |= (revcomp_bytemer << (56 - i));
-        }
-    }
+        twin.longs[N_LONGS-1-l] = get_word_revcomp(longs[l]);
 
-    uint64_t shift = KMER_SIZE % 32? 2 * (32 - (KMER_SIZE % 32)) : 0ULL;
-    uint64_t mask = KMER_SIZE % 32? ((1ULL << shift) - 1) << (64 - shift) : 0ULL;
+    /*
+     * The unused low bits of the last word, complemented, are now the top
+     * bits of the first one, and are shifted out.
+     */
+    constexpr int shift = 2 * (32 - (KMER_SIZE % 32));
 
-    twin.longs[0] <<= shift;
+    for (int l = 0; l < N_LONGS-1; ++l)
+        twin.longs[l] = (twin.longs[l] << shift) | (twin.longs[l+1] >> (64 - shift));
 
-    for (uint64_t i = 1; i < N_LONGS; ++i)
-    {
-        twin.longs[i-1] |= (twin.longs[i] & mask) >> (64 - shift);
-        twin.longs[i] <<= shift;
-    }
+    twin.longs[N_LONGS-1] <<= shift;
 
     return twin;
 }
@@ -218,6 +402,33 @@ uint64_t Kmer<N_LONGS>::GetHash() const
     return h;
 }
 
+template <int N_LONGS>
+void Kmer<N_LONGS>::CopyPackedDataInto(void *mem) const
+{
+    /*
+     * The bases fill the words from the most significant bit of longs[0]
+     * onwards, so the packed bytes are the words' bytes taken from the most
+     * significant end, stopping once all 2*KMER_SIZE bits are covered.
+     */
+    static_assert(N_PACKED_BYTES <= N_BYTES);
+
+    uint8_t *dst = static_cast<uint8_t*>(mem);
+
+    for (int i = 0; i < N_PACKED_BYTES; ++i)
+        dst[i] = static_cast<uint8_t>(longs[i/8] >> (56 - 8*(i%8)));
+}
+
+template <int N_LONGS>
+void Kmer<N_LONGS>::CopyPackedDataFrom(const void *mem)
+{
+    const uint8_t *src = static_cast<const uint8_t*>(mem);
+
+    longs = {};
+
+    for (int i = 0; i < N_PACKED_BYTES; ++i)
+        longs[i/8] |= static_cast<uint64_t>(src[i]) << (56 - 8*(i%8));
+}
+
 template <int N_LONGS>
 Vector<Kmer<N_LONGS>> Kmer<N_LONGS>::GetKmers(const String& s)
 {
@@ -243,6 +454,133 @@ template <int N_LONGS>
 Vector<Kmer<N_LONGS>> Kmer<N_LONGS>::GetRepKmers(const String& s)
 {
     auto kmers = GetKmers(s);
-    std::transform(kmers.begin(), kmers.end(), kmers.begin(), [](const Kmer& kmer) { return kmer.GetRep(); });
+    MakeRepKmers(kmers.data(), kmers.size());
     return kmers;
 }
+
+template <int N_LONGS>
+void Kmer<N_LONGS>::MakeRepKmers(Kmer *kmers, size_t count)
+{
+    static_assert(sizeof(Kmer) == N_BYTES);
+
+    size_t i = 0;
+
+#if KMER_SIMD != 0
+    i = make_rep_kmers_simd<KmerSimdOps, N_LONGS>(reinterpret_cast<uint64_t*>(kmers), count);
+#endif
+
+    for (; i < count; ++i)
+        kmers[i] = kmers[i].GetRep();
+}
+
+template <int N_LONGS>
+void Kmer<N_LONGS>::roll_forward(uint64_t const code)
+{
+    /*
+     * Drop the first nucleotide and append @code as the last one.
+     */
+
+    longs[0] <<= 2;
+
+    for (int i = 1; i < N_LONGS; ++i)
+    {
+        longs[i-1] |= (longs[i] >> 62);
+        longs[i] <<= 2;
+    }
+
+    longs[N_LONGS-1] |= (code << (2 * (32 - (KMER_SIZE%32))));
+}
+
+template <int N_LONGS>
+void Kmer<N_LONGS>::roll_reverse(uint64_t const code)
+{
+    /*
+     * Drop the last nucleotide and prepend @code as the first one. The
+     * nucleotide shifted past KMER_SIZE is masked off so that the unused
+     * low bits stay zeroed, as set_kmer and GetTwin leave them.
+     */
+
+    for (int i = N_LONGS-1; i >= 1; --i)
+    {
+        longs[i] = (longs[i] >> 2) | (longs[i-1] << 62);
+    }
+
+    longs[0] = (longs[0] >> 2) | (code << 62);
+
+    longs[N_LONGS-1] &= (~0ULL << (2 * (32 - (KMER_SIZE%32))));
+}
+
+template <int N_LONGS>
+template <typename KmerHandler>
+void Kmer<N_LONGS>::ForeachRepKmer(char const *s, size_t len, KmerHandler&& handler)
+{
+    /*
+     * Streaming version of GetRepKmers. Instead of materializing every
+     * forward k-mer and then computing each twin, we keep the forward k-mer
+     * and its reverse complement in two rolling registers which are both
+     * updated in constant time per nucleotide. The representative k-mer
+     * starting at position i is passed to @handler as handler(repmer, fwdmer, i),
+     * where fwdmer is the k-mer as it reads on the forward strand.
+     */
+
+    if (len < KMER_SIZE) return;
+
+    Kmer fwd, rev;
+
+    for (size_t i = 0; i < len; ++i)
+    {
+        uint64_t code = static_cast<uint64_t>(get_nt_code(s[i]) & 3);
+
+        fwd.roll_forward(code);
+        rev.roll_reverse(3 - code);
+
+        if (i+1 >= KMER_SIZE)
+        {
+            handler(rev < fwd? rev : fwd, fwd, i+1-KMER_SIZE);
+        }
+    }
+}
+
+template <int N_LONGS>
+template <typename KmerHandler>
+void Kmer<N_LONGS>::ForeachRepKmer(const uint64_t *words, size_t first, size_t len, KmerHandler&& handler)
+{
+    /*
+     * Same as above, for the @len bases starting at base @first of @words,
+     * which are packed 2 bits per base with the first base of each word in
+     * its top bits. The codes are shifted out of one word at a time instead
+     * of being looked up per character.
+     */
+
+    if (len < KMER_SIZE) return;
+
+    Kmer fwd, rev;
+
+    const uint64_t *wordptr = words + first / 32;
+    uint64_t word = *wordptr << (2 * (first % 32));
+    size_t numleft = 32 - (first % 32); /* codes left in word */
+
+    for (size_t i = 0; i < len; ++i)
+    {
+        if (!numleft)
+        {
+            word = *++wordptr;
+            numleft = 32;
+        }
+
+        uint64_t code = word >> 62;
+
+        word <<= 2;
+        numleft--;
+
+        fwd.roll_forward(code);
+        rev.roll_reverse(3 - code);
+
+        if (i+1 >= KMER_SIZE)
+        {
+            handler(rev < fwd? rev : fwd, fwd, i+1-KMER_SIZE);
+        }
+    }
+}
+
+} /* namespace PIPELINE_NAMESPACE */
@@ -1,21 +1,443 @@
 #include "KmerComm.h"
 #include "Bloom.h"
+#include "BlockedBloom.h"
 #include "Logger.h"
+#include "Profiler.h"
+#include "Exchange.h"
+#include "HashFuncs.h"
+#include "RadixSort.h"
 #include <cstring>
 #include <numeric>
 #include <algorithm>
 #include <iomanip>
 #include <cmath>
+#include <queue>
+#include <functional>
+
+#if USE_OPENMP == 1
+#include <omp.h>
+#endif
+
+#if SORT_COUNTING == 1 && USE_BLOOM == 1
+#error "SORT_COUNTING counts k-mers exactly and doesn't use the Bloom filter, so it requires USE_BLOOM=0"
+#endif
+
+#if SEED_BATCH_MB > 0 && (FUSED_KMER_PASS == 1 || CSR_SEEDS == 1)
+#error "SEED_BATCH_MB requires FUSED_KMER_PASS=0 and CSR_SEEDS=0"
+#endif
+
+#if COMPACT_SEEDS == 1 && FUSED_KMER_PASS == 1
+#error "COMPACT_SEEDS requires FUSED_KMER_PASS=0"
+#endif
+
+#if PREAGGREGATE_KMERS == 1 && (USE_BLOOM == 1 || FUSED_KMER_PASS == 1)
+#error "PREAGGREGATE_KMERS counts k-mers exactly on the owner, so it requires USE_BLOOM=0 and FUSED_KMER_PASS=0"
+#endif
+
+#if BLOCKED_BLOOM == 1 && USE_BLOOM == 0
+#error "BLOCKED_BLOOM requires USE_BLOOM=1"
+#endif
+
+inline namespace PIPELINE_NAMESPACE {
 
 #if USE_BLOOM == 1
-static Bloom *bm = nullptr;
+#if BLOCKED_BLOOM == 1
+typedef BlockedBloom KmerBloom;
+static constexpr bool SHARED_BLOOM = true; /* TestAndSet is atomic, so all shards share one filter */
+#else
+static_assert(BLOCKED_BLOOM == 0);
+typedef Bloom KmerBloom;
+static constexpr bool SHARED_BLOOM = false;
+#endif
+
+static Vector<KmerBloom*> bms; /* Bloom filter of each k-mer shard (see GetKmerShard), or one shared by all */
 #else
 static_assert(USE_BLOOM == 0);
 #endif
 
-KmerCountMap GetKmerCountMapKeys(const Vector <String>& myreads, SharedPtr<CommGrid> commgrid)
+#if FUSED_KMER_PASS == 1
+static Vector<Vector<uint8_t>> *seedbuckets = nullptr; /* packed seeds kept for the second exchange */
+#else
+static_assert(FUSED_KMER_PASS == 0);
+#endif
+
+static ReadId GetReadOffset(size_t numreads, SharedPtr<CommGrid> commgrid)
+{
+    /*
+     * Global id of the first local read.
+     */
+    size_t readoffset = numreads;
+    MPI_Exscan(&numreads, &readoffset, 1, MPI_SIZE_T, MPI_SUM, commgrid->GetWorld());
+    if (!commgrid->GetRank()) readoffset = 0;
+    return static_cast<ReadId>(readoffset);
+}
+
+static int GetNumThreads()
+{
+#if USE_OPENMP == 1
+    return omp_get_max_threads();
+#else
+    static_assert(USE_OPENMP == 0);
+    return 1;
+#endif
+}
+
+static int GetKmerShard(uint64_t kmerhash, int numshards)
+{
+    /*
+     * Shards split the k-mers of one processor between threads. The owner
+     * is decided by the top bits of the hash, and the hash tables use the
+     * low bits for slots and bits 32-38 for tags, so use the bits in between.
+     */
+    return static_cast<int>((kmerhash >> 39) % numshards);
+}
+
+static size_t GetMaxNumSeeds(const ReadStore& myreads, size_t first, size_t last)
+{
+    /*
+     * Upper bound on the number of seed k-mers in reads [first, last): a read
+     * of length l has at most l-KMER_SIZE+1 of them (fewer if it contains N's).
+     */
+    size_t numseeds = 0;
+
+    for (size_t i = first; i < last; ++i)
+        if (myreads.GetReadLength(i) >= KMER_SIZE)
+            numseeds += myreads.GetReadLength(i) - KMER_SIZE + 1;
+
+    return numseeds;
+}
+
+/*
+ * Index of records (k-mers, or seeds starting with a k-mer) by k-mer shard.
+ * The k-mer of every record is hashed once, when the index is built, and the
+ * records of each shard are listed in increasing order, so that a thread can
+ * walk just the records of its shard, in the order a single thread would.
+ * An empty index stands for a single shard holding every record.
+ */
+struct KmerShards
+{
+    Vector<uint64_t> hashes; /* hash of the k-mer of each record */
+    Vector<size_t> starts;   /* the records of shard s are order[starts[s]] to order[starts[s+1]-1] */
+    Vector<uint64_t> order;  /* records, grouped by shard */
+
+    bool empty() const { return starts.empty(); }
+};
+
+static KmerShards GetKmerShards(const uint8_t *recs, size_t numrecs, size_t recbytes, int numshards)
+{
+    /*
+     * The @numrecs records at @recs are @recbytes apart. Every thread counts
+     * the shards of one contiguous chunk of them, and then lists the chunk's
+     * records in each shard after those of the chunks before it.
+     */
+    KmerShards shards;
+    Vector<Vector<size_t>> offsets(numshards, Vector<size_t>(numshards, 0)); /* offsets[c][s] */
+
+    shards.hashes.resize(numrecs);
+    shards.starts.resize(numshards + 1);
+    shards.order.resize(numrecs);
+
+    auto chunkstart = [numrecs, numshards](int c) { return (numrecs * c) / numshards; };
+
+    #pragma omp parallel for schedule(static, 1)
+    for (int c = 0; c < numshards; ++c)
+    {
+        for (size_t i = chunkstart(c); i < chunkstart(c+1); ++i)
+        {
+            shards.hashes[i] = TKmer(recs + i * recbytes).GetHash();
+            offsets[c][GetKmerShard(shards.hashes[i], numshards)]++;
+        }
+    }
+
+    size_t offset = 0;
+
+    for (int s = 0; s < numshards; ++s)
+    {
+        shards.starts[s] = offset;
+
+        for (int c = 0; c < numshards; ++c)
+        {
+            size_t count = offsets[c][s];
+            offsets[c][s] = offset;
+            offset += count;
+        }
+    }
+
+    shards.starts[numshards] = offset;
+
+    #pragma omp parallel for schedule(static, 1)
+    for (int c = 0; c < numshards; ++c)
+        for (size_t i = chunkstart(c); i < chunkstart(c+1); ++i)
+            shards.order[offsets[c][GetKmerShard(shards.hashes[i], numshards)]++] = i;
+
+    return shards;
+}
+
+/*
+ * Calls f(i) for every record i of shard @s, in increasing order.
+ */
+template <typename F>
+static void ForeachShardRecord(const KmerShards& shards, size_t numrecs, int s, F f)
+{
+    if (shards.empty())
+    {
+        for (size_t i = 0; i < numrecs; ++i)
+            f(i);
+    }
+    else
+    {
+        for (size_t j = shards.starts[s]; j < shards.starts[s+1]; ++j)
+            f(shards.order[j]);
+    }
+}
+
+/*
+ * The k-mer of record @i, with the hash from @shards if it has one.
+ */
+static THashedKmer GetShardKmer(const uint8_t *recs, size_t recbytes, const KmerShards& shards, size_t i)
+{
+    if (shards.empty())
+        return THashedKmer(recs + i * recbytes);
+
+    return THashedKmer(TKmer(recs + i * recbytes), shards.hashes[i]);
+}
+
+/*
+ * State kept between the two passes of the two-pass partitioner. The reads
+ * are split into one contiguous range per thread (balanced by the number of
+ * seeds), and each thread counts and then packs the seed k-mers of its range.
+ */
+struct KmerPartition
+{
+    Vector<size_t> readstarts;               /* thread t parses reads [readstarts[t], readstarts[t+1]) */
+    Vector<Vector<int>> owners;              /* per thread: destination of each of its seed k-mers */
+    Vector<Vector<MPI_Count_type>> sendcnts; /* per thread: bytes it sends to each destination */
+};
+
+/*
+ * Splits reads [first, last) into @numthreads contiguous ranges with about
+ * the same number of seeds each.
+ */
+static Vector<size_t> SplitReads(const ReadStore& myreads, size_t first, size_t last, int numthreads)
+{
+    Vector<size_t> readstarts(1, first);
+
+    size_t totseeds = GetMaxNumSeeds(myreads, first, last);
+    size_t seedsum = 0;
+
+    for (size_t i = first; i < last && readstarts.size() < static_cast<size_t>(numthreads); ++i)
+    {
+        seedsum += GetMaxNumSeeds(myreads, i, i+1);
+
+        if (seedsum * numthreads >= totseeds * readstarts.size())
+            readstarts.push_back(i+1);
+    }
+
+    readstarts.resize(numthreads + 1, last);
+
+    return readstarts;
+}
+
+/*
+ * Where each thread starts writing into each destination's part of the send
+ * buffer, so that the part of each destination is filled in thread order.
+ */
+static Vector<Vector<MPI_Displ_type>> GetThreadOffsets(const KmerPartition& partition, const Vector<MPI_Displ_type>& sdispls)
+{
+    int nprocs = sdispls.size();
+    int numthreads = partition.sendcnts.size();
+
+    Vector<Vector<MPI_Displ_type>> offsets(numthreads, sdispls);
+
+    for (int t = 1; t < numthreads; ++t)
+        for (int i = 0; i < nprocs; ++i)
+            offsets[t][i] = offsets[t-1][i] + partition.sendcnts[t-1][i];
+
+    return offsets;
+}
+
+/*
+ * First pass: finds the destination of every seed k-mer of reads [first, last)
+ * and sets @sendcnt to the bytes (@recbytes per seed) sent to each destination.
+ * If @hll is given, every seed k-mer is also added to it. Returns the number
+ * of seeds dropped by the partitioner.
+ */
+static size_t CountKmers(const ReadStore& myreads, size_t first, size_t last, size_t recbytes, HyperLogLog *hll, KmerPartition& partition, Vector<MPI_Count_type>& sendcnt)
+{
+    int nprocs = sendcnt.size();
+    int numthreads = GetNumThreads();
+
+    partition.readstarts = SplitReads(myreads, first, last, numthreads);
+
+    partition.owners.assign(numthreads, Vector<int>());
+    partition.sendcnts.assign(numthreads, Vector<MPI_Count_type>(nprocs, 0));
+
+    Vector<HyperLogLog> hlls(hll? numthreads : 0, hll? *hll : HyperLogLog());
+    Vector<size_t> numdropped(numthreads, 0);
+
+    #pragma omp parallel for schedule(static, 1)
+    for (int t = 0; t < numthreads; ++t)
+    {
+        size_t first = partition.readstarts[t];
+        size_t last = partition.readstarts[t+1];
+
+        size_t maxnumseeds = GetMaxNumSeeds(myreads, first, last);
+
+        partition.owners[t].reserve(maxnumseeds);
+
+        KmerPartitioner partitioner(nprocs, maxnumseeds);
+        KmerCountingHandler counter(partition.sendcnts[t], partition.owners[t], partitioner, recbytes, hll? &hlls[t] : nullptr);
+        ForeachKmer(myreads, first, last, counter);
+
+#if SKEW_AWARE_PARTITION == 1
+        numdropped[t] = partitioner.numdropped;
+#endif
+    }
+
+    std::fill(sendcnt.begin(), sendcnt.end(), 0);
+
+    for (int t = 0; t < numthreads; ++t)
+    {
+        for (int i = 0; i < nprocs; ++i)
+            sendcnt[i] += partition.sendcnts[t][i];
+
+        if (hll) hll->Merge(hlls[t]);
+    }
+
+    return std::accumulate(numdropped.begin(), numdropped.end(), static_cast<size_t>(0));
+}
+
+/*
+ * Second pass: every thread writes the seed k-mers of its range into @sendbuf
+ * with the packing handler made by makepacker(sendbuf, offsets, owners). The
+ * part of each destination is filled in thread order, so @sendbuf ends up
+ * the same as it would with a single thread.
+ */
+template <typename MakePacker>
+static void PackKmers(const ReadStore& myreads, KmerPartition& partition, const Vector<MPI_Displ_type>& sdispls, uint8_t *sendbuf, MakePacker makepacker)
+{
+    int numthreads = partition.owners.size();
+
+    Vector<Vector<MPI_Displ_type>> offsets = GetThreadOffsets(partition, sdispls);
+
+    #pragma omp parallel for schedule(static, 1)
+    for (int t = 0; t < numthreads; ++t)
+    {
+        auto packer = makepacker(sendbuf, offsets[t], partition.owners[t]);
+        ForeachKmer(myreads, partition.readstarts[t], partition.readstarts[t+1], packer);
+
+        assert(packer.i == partition.owners[t].size());
+        Vector<int>().swap(partition.owners[t]);
+    }
+}
+
+/*
+ * Local combine step of PREAGGREGATE_KMERS, in place of CountKmers: every
+ * thread counts the seed k-mers of its range of reads into @localcounts[t],
+ * and @sendcnt is set to the bytes (KMER_COUNT_BYTES per distinct k-mer of
+ * each thread) sent to each destination.
+ */
+static void CombineKmers(const ReadStore& myreads, HyperLogLog& hll, KmerPartition& partition, Vector<LocalKmerCountMap>& localcounts, Vector<MPI_Count_type>& sendcnt)
+{
+    int nprocs = sendcnt.size();
+    int numthreads = GetNumThreads();
+
+    partition.readstarts = SplitReads(myreads, 0, myreads.size(), numthreads);
+    partition.sendcnts.assign(numthreads, Vector<MPI_Count_type>(nprocs, 0));
+
+    localcounts.assign(numthreads, LocalKmerCountMap());
+
+    Vector<HyperLogLog> hlls(numthreads, hll);
+
+    #pragma omp parallel for schedule(static, 1)
+    for (int t = 0; t < numthreads; ++t)
+    {
+        KmerCombiningHandler combiner(localcounts[t], partition.sendcnts[t], hlls[t]);
+        ForeachKmer(myreads, partition.readstarts[t], partition.readstarts[t+1], combiner);
+    }
+
+    std::fill(sendcnt.begin(), sendcnt.end(), 0);
+
+    for (int t = 0; t < numthreads; ++t)
+    {
+        for (int i = 0; i < nprocs; ++i)
+            sendcnt[i] += partition.sendcnts[t][i];
+
+        hll.Merge(hlls[t]);
+    }
+}
+
+/*
+ * Writes the k-mers of @localcounts and their counts into @sendbuf, each
+ * thread's in the order in which it first saw them.
+ */
+static void PackKmerCounts(const KmerPartition& partition, Vector<LocalKmerCountMap>& localcounts, const Vector<MPI_Displ_type>& sdispls, uint8_t *sendbuf)
+{
+    int numthreads = localcounts.size();
+
+    Vector<Vector<MPI_Displ_type>> offsets = GetThreadOffsets(partition, sdispls);
+
+    #pragma omp parallel for schedule(static, 1)
+    for (int t = 0; t < numthreads; ++t)
+    {
+        for (auto entry : localcounts[t])
+        {
+            MPI_Displ_type& offset = offsets[t][entry.second.owner];
+
+            entry.first.CopyDataInto(sendbuf + offset);
+            std::memcpy(sendbuf + offset + TKmer::N_BYTES, &entry.second.count, sizeof(LocalKmerCount));
+            offset += KMER_COUNT_BYTES;
+        }
+
+        localcounts[t] = LocalKmerCountMap();
+    }
+}
+
+/*
+ * Inserts the k-mers of records @subfirsts[s] (in increasing order, the first
+ * record of each k-mer of shard s that is kept) into @kmermap, in increasing
+ * order of the records. This is the order in which a single thread would have
+ * inserted them, so kmermap doesn't depend on the number of threads. The
+ * k-mers are read from the records, and not hashed again.
+ */
+static void MergeShards(KmerCountMap& kmermap, const uint8_t *recs, size_t recbytes, const KmerShards& shards, Vector<Vector<uint64_t>>& subfirsts)
+{
+    int numshards = subfirsts.size();
+    size_t numkmers = 0;
+
+    for (int s = 0; s < numshards; ++s)
+        numkmers += subfirsts[s].size();
+
+    kmermap.reserve(numkmers);
+
+    typedef std::pair<uint64_t, int> ShardHead; /* next record of a shard, and the shard */
+
+    std::priority_queue<ShardHead, Vector<ShardHead>, std::greater<ShardHead>> heads;
+    Vector<size_t> next(numshards, 0);
+
+    for (int s = 0; s < numshards; ++s)
+        if (!subfirsts[s].empty())
+            heads.push({subfirsts[s].front(), s});
+
+    while (!heads.empty())
+    {
+        auto [i, s] = heads.top();
+        heads.pop();
+
+        THashedKmer mer = GetShardKmer(recs, recbytes, shards, i);
+        kmermap.try_emplace(mer.kmer, mer.hash);
+
+        if (++next[s] < subfirsts[s].size())
+            heads.push({subfirsts[s][next[s]], s});
+    }
+
+    Vector<Vector<uint64_t>>().swap(subfirsts);
+}
+
+KmerCountMap GetKmerCountMapKeys(const ReadStore& myreads, SharedPtr<CommGrid> commgrid)
 {
     std::unique_ptr<std::ostringstream> logstream;
+    PhaseTimer hlltimer(PROFILE_HLL);
 
     /*
      * This function initializes an associative container of k-mers on each processor,
@@ -57,8 +479,55 @@ KmerCountMap GetKmerCountMapKeys(const Vector <String>& myreads, SharedPtr<CommG
      * to the HyperLogLog counter.
      */
     HyperLogLog hll(12);
-    KmerEstimateHandler estimator(hll);
-    ForeachKmer(myreads, estimator); /* Adds each representative seed k-mer to HyperLogLog */
+
+#if FUSED_KMER_PASS == 1
+    /*
+     * In fused mode the same pass also does the partitioning described below,
+     * storing the full seeds (k-mer, read id, position) in their outgoing buckets.
+     * Those buckets are kept around so that GetKmerCountMapValues doesn't have
+     * to parse the reads a second time.
+     */
+    seedbuckets = new Vector<Vector<uint8_t>>(nprocs);
+    KmerFusedHandler fused(hll, *seedbuckets, GetReadOffset(numreads, commgrid));
+    ForeachKmer(myreads, fused); /* Adds each representative seed k-mer to HyperLogLog and to its proper outgoing bucket */
+#else
+    static_assert(FUSED_KMER_PASS == 0);
+
+    /*
+     * Otherwise the same pass also does the first half of the partitioning
+     * described below: it finds the destination of each seed k-mer and counts
+     * the bytes that go to each destination.
+     */
+    Vector<MPI_Count_type> sendcnt(nprocs); /* sendcnt[i] is number of bytes of k-mers this process sends to process i */
+    KmerPartition partition;
+
+#if PREAGGREGATE_KMERS == 1
+    /*
+     * With pre-aggregation, the pass counts the seed k-mers locally instead,
+     * and only the distinct k-mers and their counts are sent.
+     */
+    constexpr size_t recbytes = KMER_COUNT_BYTES;
+
+    Vector<LocalKmerCountMap> localcounts;
+    CombineKmers(myreads, hll, partition, localcounts, sendcnt); /* Adds each distinct local k-mer to HyperLogLog and counts it against its destination */
+#else
+    static_assert(PREAGGREGATE_KMERS == 0);
+
+    constexpr size_t recbytes = TKmer::N_BYTES;
+
+#if SKEW_AWARE_PARTITION == 1
+    size_t numdropped = CountKmers(myreads, 0, numreads, recbytes, &hll, partition, sendcnt); /* Adds each representative seed k-mer to HyperLogLog and counts it against its destination */
+
+    logstream.reset(new std::ostringstream());
+    *logstream << "dropped " << numdropped << " seed k-mers of k-mers seen more than " << UPPER_KMER_FREQ+1 << " times locally";
+    LogAll(logstream->str(), commgrid);
+#else
+    static_assert(SKEW_AWARE_PARTITION == 0);
+
+    CountKmers(myreads, 0, numreads, recbytes, &hll, partition, sendcnt); /* Adds each representative seed k-mer to HyperLogLog and counts it against its destination */
+#endif
+#endif
+#endif
 
     /*
      * The KmerEstimateHandler object took the HyperLogLog object by reference, so
@@ -86,6 +555,10 @@ KmerCountMap GetKmerCountMapKeys(const Vector <String>& myreads, SharedPtr<CommG
 
     MPI_Barrier(commgrid->GetWorld());
 
+    hlltimer.Stop();
+
+    PhaseTimer exchangetimer(PROFILE_EXCHANGE1);
+
     /*
      * Remember what the final goal is: we want to find all the "seed k-mers" whose corresponding
      * "k-mer" appears in the sequencing reads between LOWER_KMER_FREQ and UPPER_KMER_FREQ different
@@ -99,36 +572,31 @@ KmerCountMap GetKmerCountMapKeys(const Vector <String>& myreads, SharedPtr<CommG
      * to determine whether it is reliable or not, there is a single processor responsible
      * for counting that "k-mer".
      *
-     * We do this using the KmerPartitionHandler function object, which assigns k-mers to processor
-     * ranks using an injective function based on the hash of the k-mer. The object takes
-     * a vector of "k-mer buckets", one for each processor destination, so that we can put each
-     * "seed k-mer" found in the local read set into its correct outgoing bucket before
-     * peforming an Alltoall communication. The result of the Altoall will be that each processor
-     * receives a list of "seed k-mers" assigned to it by the partitioner, such that each "k-mer"
-     * has a unique processor destination id.
+     * We do this with a two-pass partitioner, which assigns k-mers to processor ranks using
+     * an injective function based on the hash of the k-mer. The first pass (done above by
+     * KmerCountingHandler) records the destination of every "seed k-mer" found in the local read
+     * set and counts how many bytes go to each destination. The second pass (KmerPackingHandler)
+     * then writes each "seed k-mer" straight into its destination's part of one contiguous send
+     * buffer, before peforming an Alltoall communication. The result of the Altoall will be that
+     * each processor receives a list of "seed k-mers" assigned to it by the partitioner, such
+     * that each "k-mer" has a unique processor destination id.
      *
      */
 
-    Vector<Vector<TKmer>> kmerbuckets(nprocs); /* outgoing k-mer buckets */
-    KmerPartitionHandler partitioner(kmerbuckets);
-    ForeachKmer(myreads, partitioner); /* adds each representative seed k-mer to its proper outgoing bucket */
-
-    /*
-     * Now that we know where all the k-mers need to be sent to, we just need pack
-     * the data into a contiguous buffer and compute the corresponding Alltoallv
-     * communication parameters so that we can send the k-mers around.
-     */
-
+#if FUSED_KMER_PASS == 1
     Vector<MPI_Count_type> sendcnt(nprocs); /* sendcnt[i] is number of bytes of k-mers this process sends to process i */
+    constexpr size_t recbytes = TKmer::N_BYTES;
+#endif
     Vector<MPI_Count_type> recvcnt(nprocs); /* recvnct[i] is number of bytes of k-mers this process receives from process i */
-    Vector<MPI_Displ_type> sdispls(nprocs); /* sdispls[i] = sdispls[i-1] + sendcnt[i] */
+    Vector<MPI_Displ_type> sdispls(nprocs); /* sdispls[i] is where the k-mers for process i start in the send buffer (see GetSendDispls) */
     Vector<MPI_Displ_type> rdispls(nprocs); /* rdispls[i] = rdispls[i-1] + recvcnt[i] */
 
     logstream.reset(new std::ostringstream());
     *logstream << std::setprecision(4) << "sending 'row' k-mers to each processor in this amount (megabytes): {";
 
     /*
-     * Initialize sendcnt parameter for local process.
+     * Initialize sendcnt parameter for local process (the two-pass
+     * partitioner already counted them in the non-fused case).
      */
     for (int i = 0; i < nprocs; ++i)
     {
@@ -136,7 +604,9 @@ KmerCountMap GetKmerCountMapKeys(const Vector <String>& myreads, SharedPtr<CommG
          * Each k-mer is a fixed number of bytes (TKmer::N_BYTES),
          * usually 16 for 32 < k < 64.
          */
-        sendcnt[i] = kmerbuckets[i].size() * TKmer::N_BYTES;
+#if FUSED_KMER_PASS == 1
+        sendcnt[i] = ((*seedbuckets)[i].size() / KMER_SEED_BYTES) * TKmer::N_BYTES;
+#endif
         *logstream << (static_cast<double>(sendcnt[i]) / (1024 * 1024)) << ",";
     }
 
@@ -148,54 +618,62 @@ KmerCountMap GetKmerCountMapKeys(const Vector <String>& myreads, SharedPtr<CommG
      * Let every process know how many k-mers it will be receiving
      * from each other process.
      */
-    MPI_ALLTOALL(sendcnt.data(), 1, MPI_COUNT_TYPE, recvcnt.data(), 1, MPI_COUNT_TYPE, commgrid->GetWorld());
+    ExchangePlan plan(PROFILE_EXCHANGE1);
+    ExchangeCounts(sendcnt, recvcnt, plan, commgrid);
 
     /*
      * Initialize displacement parameters now that we know both send and receive counts.
      */
-    sdispls.front() = rdispls.front() = 0;
+    GetSendDispls(sendcnt, sdispls, commgrid);
 
-    std::partial_sum(sendcnt.begin(), sendcnt.end()-1, sdispls.begin()+1);
+    rdispls.front() = 0;
     std::partial_sum(recvcnt.begin(), recvcnt.end()-1, rdispls.begin()+1);
 
     /*
      * Need total send and receive buffer sizes in order to allocate
      * the memory.
      */
-    int64_t totsend = std::accumulate(sendcnt.begin(), sendcnt.end(), 0);
-    int64_t totrecv = std::accumulate(recvcnt.begin(), recvcnt.end(), 0);
+    int64_t totsend = std::accumulate(sendcnt.begin(), sendcnt.end(), static_cast<int64_t>(0));
+    int64_t totrecv = std::accumulate(recvcnt.begin(), recvcnt.end(), static_cast<int64_t>(0));
 
     /*
      * Pack send buffer.
      */
     Vector<uint8_t> sendbuf(totsend, 0);
 
+#if FUSED_KMER_PASS == 1
     for (int i = 0; i < nprocs; ++i)
     {
-        assert(kmerbuckets[i].size() == (sendcnt[i] / TKmer::N_BYTES));
-
         /*
-         * Get starting adddress of buffer space for kmerbuckets[i].
+         * Get starting adddress of buffer space for (*seedbuckets)[i].
          */
         uint8_t *addrs2fill = sendbuf.data() + sdispls[i];
 
-        for (MPI_Count_type j = 0; j < kmerbuckets[i].size(); ++j)
+        /*
+         * Only the k-mer part of each cached seed is sent in
+         * this exchange. The seeds stay in their buckets.
+         */
+        const uint8_t *addrs2copy = (*seedbuckets)[i].data();
+
+        for (MPI_Count_type j = 0; j < sendcnt[i] / TKmer::N_BYTES; ++j)
         {
-            /*
-             * Copy jth k-mer to be sent to ith processor into the
-             * next available spot in the buffer.
-             */
-            (kmerbuckets[i][j]).CopyDataInto(addrs2fill);
+            std::memcpy(addrs2fill, addrs2copy, TKmer::N_BYTES);
             addrs2fill += TKmer::N_BYTES;
+            addrs2copy += KMER_SEED_BYTES;
         }
-
-        /*
-         * Now that the k-mers to be sent to the ith processor
-         * have been fully packed into the buffer, we don't
-         * need them anymore.
-         */
-        kmerbuckets[i].clear();
     }
+#elif PREAGGREGATE_KMERS == 1
+    PackKmerCounts(partition, localcounts, sdispls, sendbuf.data());
+#else
+    /*
+     * Second pass of the partitioner: write every seed k-mer into its place.
+     */
+    PackKmers(myreads, partition, sdispls, sendbuf.data(),
+              [](uint8_t *buf, const Vector<MPI_Displ_type>& offsets, const Vector<int>& owners)
+              {
+                  return KmerPackingHandler(buf, offsets, owners);
+              });
+#endif
 
     /*
      * Allocate receive buffer.
@@ -205,212 +683,798 @@ KmerCountMap GetKmerCountMapKeys(const Vector <String>& myreads, SharedPtr<CommG
     /*
      * Send all the k-mers around.
      */
-    MPI_ALLTOALLV(sendbuf.data(), sendcnt.data(), sdispls.data(), MPI_BYTE, recvbuf.data(), recvcnt.data(), rdispls.data(), MPI_BYTE, commgrid->GetWorld());
+    ExchangeBytes(sendbuf.data(), sendcnt, sdispls, recvbuf.data(), recvcnt, rdispls, plan, commgrid);
 
-    size_t rowkmers_received = static_cast<size_t>(totrecv / TKmer::N_BYTES);
+    size_t rowkmers_received = static_cast<size_t>(totrecv / recbytes);
     logstream.reset(new std::ostringstream());
     *logstream << "received a total of " << rowkmers_received << " 'row' k-mers in first ALLTOALL exchange";
     LogAll(logstream->str(), commgrid);
 
-    kmermap.reserve(avgcardinality);
+    exchangetimer.Stop();
 
-#if USE_BLOOM == 1
-    bm = new Bloom(static_cast<int64_t>(std::ceil(cardinality)), 0.05);
-#else
-    static_assert(USE_BLOOM == 0);
-#endif
+    PhaseTimer inserttimer(PROFILE_INSERT);
 
     /*
-     * Get actual number of k-mer seeds received.
+     * Get actual number of k-mer seeds received (or of k-mer counts, with pre-aggregation).
      */
-    uint64_t numkmerseeds = totrecv / TKmer::N_BYTES;
+    uint64_t numkmerseeds = totrecv / recbytes;
 
-    uint8_t *addrs2read = recvbuf.data();
+#if PREAGGREGATE_KMERS == 1
+    /*
+     * Every received record is a k-mer and the number of its seeds on one sender
+     * thread. The counts of each k-mer are summed up exactly, one shard per thread
+     * (see GetKmerShard), and then only the reliable k-mers are inserted, in the
+     * order in which they were first received.
+     */
+    int numshards = GetNumThreads();
+
+    KmerShards shards;
+    Vector<Vector<uint64_t>> subfirsts(numshards); /* first record of each reliable k-mer of the shard */
+
+    if (numshards > 1)
+        shards = GetKmerShards(recvbuf.data(), numkmerseeds, KMER_COUNT_BYTES, numshards);
 
-    for (uint64_t i = 0; i < numkmerseeds; ++i)
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int s = 0; s < numshards; ++s)
     {
-        TKmer mer(addrs2read);
-        addrs2read += TKmer::N_BYTES;
+        FlatHashMap<TKmer, uint64_t> counts; /* total count of each k-mer of the shard */
+        Vector<uint64_t> firsts;             /* first record of each k-mer in counts */
 
-#if USE_BLOOM == 1
-        if (bm->Check(mer.GetBytes(), TKmer::N_BYTES))
-        {
-            /*
-             * k-mer was in the bloom filter, which
-             * means it has probably been seen before and
-             * is therefore probably not unique, so we
-             * add it to the hash table if it isn't there
-             * (checking the hash table is much more expensive
-             * then the Bloom filter)
-             */
-            if (kmermap.find(mer) == kmermap.end())
-            {
-                kmermap.insert({mer, KmerCountEntry({}, {}, 0)});
-            }
-        }
-        else
-        {
-            /*
-             * k-mer wasn't in the Bloom filter, which
-             * means it definitley hasn't been seen yet. Add
-             * it to the Bloom filter, so that if it never
-             * shows up again we don't have to check the
-             * more expensive hash table for a unique k-mer.
-             * Remember that a signifncat fraction of k-mers
-             * are unique (due to read errors) so this will
-             * save significant time during the k-mer discovery
-             * phase.
-             */
-            bm->Add(mer.GetBytes(), TKmer::N_BYTES);
-        }
-#else
-        static_assert(USE_BLOOM == 0);
+        counts.reserve(avgcardinality / numshards);
 
-        if (kmermap.find(mer) == kmermap.end())
+        ForeachShardRecord(shards, numkmerseeds, s, [&](size_t i)
         {
-            kmermap.insert({mer, KmerCountEntry({}, {}, 0)});
-        }
-#endif
-    }
+            THashedKmer mer = GetShardKmer(recvbuf.data(), KMER_COUNT_BYTES, shards, i);
+            LocalKmerCount count;
 
-    logstream.reset(new std::ostringstream());
-    *logstream << rowkmers_received;
-#if USE_BLOOM == 1
-    *logstream << " row k-mers filtered by Bloom filter and hash table into " << kmermap.size() << " likely non-singleton 'column' k-mers";
-#else
-    *logstream << " row k-mers filtered by hash table into " << kmermap.size() << " 'column' k-mers";
-#endif
+            std::memcpy(&count, recvbuf.data() + i * KMER_COUNT_BYTES + TKmer::N_BYTES, sizeof(LocalKmerCount));
 
-    LogAll(logstream->str(), commgrid);
+            auto [itr, inserted] = counts.try_emplace(mer.kmer, mer.hash);
 
-    return kmermap;
-}
+            if (inserted) firsts.push_back(i);
 
-void GetKmerCountMapValues(const Vector<String>& myreads, KmerCountMap& kmermap, SharedPtr<CommGrid> commgrid)
-{
-    std::unique_ptr<std::ostringstream> logstream;
+            itr->second += count;
+        });
 
-    int myrank = commgrid->GetRank();
-    int nprocs = commgrid->GetSize();
-    size_t numreads = myreads.size();
+        size_t j = 0;
 
-    Vector<Vector<KmerSeed>> kmerseeds(nprocs);
+        for (auto entry : counts)
+        {
+            if (entry.second >= LOWER_KMER_FREQ && entry.second <= UPPER_KMER_FREQ)
+                subfirsts[s].push_back(firsts[j]);
 
-    size_t readoffset = numreads;
-    MPI_Exscan(&numreads, &readoffset, 1, MPI_SIZE_T, MPI_SUM, commgrid->GetWorld());
-    if (!myrank) readoffset = 0;
+            ++j;
+        }
+    }
 
-    KmerParserHandler parser(kmerseeds, static_cast<ReadId>(readoffset));
-    ForeachKmer(myreads, parser);
+    MergeShards(kmermap, recvbuf.data(), KMER_COUNT_BYTES, shards, subfirsts);
+#elif SORT_COUNTING == 1
+    /*
+     * Sort the received k-mers so that all the seeds of a k-mer are adjacent,
+     * and then count each run exactly. Since the counts are exact, only the
+     * k-mers that are already known to be reliable are inserted, and no Bloom
+     * filter is needed.
+     */
+    RadixSortRecords(recvbuf.data(), numkmerseeds, TKmer::N_BYTES, TKmer::N_BYTES / 8);
+
+    Vector<uint64_t> runstarts; /* first seed of each reliable k-mer's run */
+
+    for (uint64_t i = 0; i < numkmerseeds; )
+    {
+        const uint8_t *run = recvbuf.data() + i * TKmer::N_BYTES;
+        uint64_t j = i + 1;
+
+        while (j < numkmerseeds && !std::memcmp(run, recvbuf.data() + j * TKmer::N_BYTES, TKmer::N_BYTES))
+            ++j;
+
+        if (j - i >= LOWER_KMER_FREQ && j - i <= UPPER_KMER_FREQ)
+            runstarts.push_back(i);
+
+        i = j;
+    }
+
+    kmermap.reserve(runstarts.size());
+
+    for (uint64_t i : runstarts)
+    {
+        THashedKmer mer(recvbuf.data() + i * TKmer::N_BYTES);
+        kmermap.try_emplace(mer.kmer, mer.hash);
+    }
+#else
+    static_assert(SORT_COUNTING == 0);
+
+    /*
+     * The received k-mers are split into shards by their hash (see GetKmerShard),
+     * and each thread counts the k-mers of one shard into its own hash set and
+     * Bloom filter, so that the threads never touch the same k-mer. The sets
+     * only hold the k-mers, and are freed before their k-mers are merged into
+     * kmermap. With a single shard, the k-mers go straight into kmermap.
+     */
+    int numshards = GetNumThreads();
+
+    KmerShards shards;
+    Vector<Vector<uint64_t>> subfirsts(numshards); /* received k-mer that inserted each k-mer of the shard */
+
+    if (numshards > 1)
+        shards = GetKmerShards(recvbuf.data(), numkmerseeds, TKmer::N_BYTES, numshards);
+
+#if USE_BLOOM == 1
+    /*
+     * The filters are sized from this processor's share of the k-mers.
+     */
+    int numblooms = SHARED_BLOOM? 1 : numshards;
+
+    for (int b = 0; b < numblooms; ++b)
+        bms.push_back(new KmerBloom(std::max(static_cast<int64_t>(1), static_cast<int64_t>(avgcardinality / numblooms)), 0.05));
+#else
+    static_assert(USE_BLOOM == 0);
+#endif
+
+    auto countkmers = [&](auto& submap, int s)
+    {
+        submap.reserve(avgcardinality / numshards);
+
+#if USE_BLOOM == 1
+        KmerBloom *bm = bms[s % numblooms];
+#endif
+
+        ForeachShardRecord(shards, numkmerseeds, s, [&](size_t i)
+        {
+            /*
+             * The received k-mer is hashed exactly once (here, or by
+             * GetKmerShards), and that hash is reused for both the
+             * Bloom filter and the hash table.
+             */
+            THashedKmer mer = GetShardKmer(recvbuf.data(), TKmer::N_BYTES, shards, i);
+            bool inserted = false;
+
+#if USE_BLOOM == 1
+            if (bm->TestAndSet(mer.hash))
+            {
+                /*
+                 * k-mer was in the bloom filter, which
+                 * means it has probably been seen before and
+                 * is therefore probably not unique, so we
+                 * add it to the hash table if it isn't there
+                 * (checking the hash table is much more expensive
+                 * then the Bloom filter)
+                 */
+                inserted = submap.try_emplace(mer.kmer, mer.hash).second;
+            }
+
+            /*
+             * Otherwise the k-mer wasn't in the Bloom filter,
+             * which means it definitley hasn't been seen yet,
+             * and TestAndSet has now added it to the Bloom filter,
+             * so that if it never shows up again we don't have
+             * to check the more expensive hash table for a unique
+             * k-mer. Remember that a signifncat fraction of k-mers
+             * are unique (due to read errors) so this will
+             * save significant time during the k-mer discovery
+             * phase.
+             */
+#else
+            inserted = submap.try_emplace(mer.kmer, mer.hash).second; /* inserts a zeroed KmerCountEntry if the k-mer isn't there yet */
+#endif
+
+            if (inserted && numshards > 1)
+                subfirsts[s].push_back(i);
+        });
+    };
+
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int s = 0; s < numshards; ++s)
+    {
+        if (numshards > 1)
+        {
+            FlatHashMap<TKmer, bool> submap; /* the k-mers of the shard so far (the values are unused) */
+            countkmers(submap, s);
+        }
+        else
+        {
+            countkmers(kmermap, s);
+        }
+    }
+
+    if (numshards > 1)
+        MergeShards(kmermap, recvbuf.data(), TKmer::N_BYTES, shards, subfirsts);
+#endif
+
+    logstream.reset(new std::ostringstream());
+    *logstream << rowkmers_received;
+#if PREAGGREGATE_KMERS == 1
+    *logstream << " row k-mer counts summed into " << kmermap.size() << " reliable 'column' k-mers";
+#elif SORT_COUNTING == 1
+    *logstream << " row k-mers sorted and counted into " << kmermap.size() << " reliable 'column' k-mers";
+#elif USE_BLOOM == 1
+    *logstream << " row k-mers filtered by Bloom filter and hash table into " << kmermap.size() << " likely non-singleton 'column' k-mers";
+#else
+    *logstream << " row k-mers filtered by hash table into " << kmermap.size() << " 'column' k-mers";
+#endif
+
+    LogAll(logstream->str(), commgrid);
+
+    return kmermap;
+}
+
+/*
+ * Looks up the KmerCountEntry of received seeds. Consecutive seeds of the same
+ * k-mer (every seed of a run, once sorted) reuse the previous lookup instead of
+ * hashing and probing the table again. Only reads kmermap and the Bloom filters,
+ * so threads can each use their own finder at the same time.
+ */
+struct KmerEntryFinder
+{
+    KmerCountMap& kmermap;
+    TKmer lastkmer;
+    KmerCountEntry *lastentry;
+    bool haslast;
+
+    KmerEntryFinder(KmerCountMap& kmermap) : kmermap(kmermap), lastentry(nullptr), haslast(false) {}
+
+    /*
+     * Returns the entry of the seed k-mer stored at @addrs, or
+     * nullptr if the k-mer isn't in kmermap.
+     */
+    KmerCountEntry* operator()(const uint8_t *addrs)
+    {
+        return lookup(TKmer(addrs), nullptr);
+    }
+
+    /*
+     * Same, for a seed whose k-mer hash is already known.
+     */
+    KmerCountEntry* operator()(const uint8_t *addrs, uint64_t hash)
+    {
+        return lookup(TKmer(addrs), &hash);
+    }
+
+    KmerCountEntry* lookup(const TKmer& kmer, const uint64_t *hash)
+    {
+        if (haslast && kmer == lastkmer)
+            return lastentry;
+
+        THashedKmer hmer = hash? THashedKmer(kmer, *hash) : THashedKmer(kmer);
+
+        lastkmer = kmer;
+        lastentry = nullptr;
+        haslast = true;
+
+#if USE_BLOOM == 1
+        if (!bms[GetKmerShard(hmer.hash, bms.size())]->Check(hmer.hash))
+            return lastentry;
+#else
+        static_assert(USE_BLOOM == 0);
+#endif
+
+        auto kmitr = kmermap.find(hmer.kmer, hmer.hash);
+
+        if (kmitr != kmermap.end())
+            lastentry = &kmitr->second;
+
+        return lastentry;
+    }
+};
+
+#if FUSED_KMER_PASS == 0
+/*
+ * Packs the seeds of reads [first, last) into @sendbuf (SEED_WIRE_BYTES per
+ * seed) with the two-pass partitioner, and fills in the per-destination byte
+ * counts and displacements.
+ */
+static void PackKmerSeeds(const ReadStore& myreads, size_t first, size_t last, ReadId readoffset, Vector<uint8_t>& sendbuf, Vector<MPI_Count_type>& sendcnt, Vector<MPI_Displ_type>& sdispls, SharedPtr<CommGrid> commgrid)
+{
+    KmerPartition partition;
+
+    CountKmers(myreads, first, last, SEED_WIRE_BYTES, nullptr, partition, sendcnt);
+
+    GetSendDispls(sendcnt, sdispls, commgrid);
+
+    sendbuf.resize(std::accumulate(sendcnt.begin(), sendcnt.end(), static_cast<size_t>(0)));
+
+    PackKmers(myreads, partition, sdispls, sendbuf.data(),
+              [readoffset](uint8_t *buf, const Vector<MPI_Displ_type>& offsets, const Vector<int>& owners)
+              {
+                  return KmerSeedPackingHandler(buf, offsets, owners, readoffset);
+              });
+}
+#endif
+
+#if COMPACT_SEEDS == 1
+static Vector<ReadId> GetReadOffsets(size_t numreads, SharedPtr<CommGrid> commgrid)
+{
+    /*
+     * Global id of the first read of every processor.
+     */
+    ReadId readoffset = GetReadOffset(numreads, commgrid);
+    Vector<ReadId> readoffsets(commgrid->GetSize());
+
+    static_assert(sizeof(ReadId) == sizeof(uint64_t));
+    MPI_Allgather(&readoffset, 1, MPI_UINT64_T, readoffsets.data(), 1, MPI_UINT64_T, commgrid->GetWorld());
+
+    return readoffsets;
+}
+
+/*
+ * Expands the compact seeds received in @recvbuf (SEED_WIRE_BYTES each, the
+ * seeds from processor i starting at @rdispls[i]) into KMER_SEED_BYTES seeds
+ * with global read ids. Seeds are expanded from the back, so that a seed is
+ * always read before the expanded seeds in front of it overwrite it, which
+ * lets the expansion happen in place. Reserving the expanded size for
+ * @recvbuf before receiving keeps the resize from reallocating.
+ */
+static void UnpackKmerSeeds(Vector<uint8_t>& recvbuf, const Vector<MPI_Displ_type>& rdispls, const Vector<ReadId>& readoffsets)
+{
+    int nprocs = rdispls.size();
+    size_t numseeds = recvbuf.size() / SEED_WIRE_BYTES;
+
+    recvbuf.resize(numseeds * KMER_SEED_BYTES);
+
+    size_t j = numseeds;
+
+    for (int i = nprocs-1; i >= 0; --i)
+    {
+        size_t first = rdispls[i] / SEED_WIRE_BYTES;
+
+        while (j > first)
+        {
+            --j;
+
+            const uint8_t *addrs2read = recvbuf.data() + j * SEED_WIRE_BYTES;
+
+            TKmer kmer;
+            LocalReadId localid;
+            PosInRead pos;
+
+            kmer.CopyPackedDataFrom(addrs2read);
+            std::memcpy(&localid, addrs2read + TKmer::N_PACKED_BYTES, sizeof(LocalReadId));
+            std::memcpy(&pos, addrs2read + TKmer::N_PACKED_BYTES + sizeof(LocalReadId), sizeof(PosInRead));
+
+            ReadId readid = readoffsets[i] + localid;
+
+            uint8_t *addrs2fill = recvbuf.data() + j * KMER_SEED_BYTES;
+
+            kmer.CopyDataInto(addrs2fill);
+            std::memcpy(addrs2fill + TKmer::N_BYTES, &readid, sizeof(ReadId));
+            std::memcpy(addrs2fill + TKmer::N_BYTES + sizeof(ReadId), &pos, sizeof(PosInRead));
+        }
+    }
+
+    assert(j == 0);
+}
+#endif
+
+#if CSR_SEEDS == 0
+/*
+ * Adds the @numseeds packed seeds stored at @seeds to the k-mers of @kmermap
+ * they belong to. k-mers seen more than UPPER_KMER_FREQ times are marked with
+ * a count of UPPER_KMER_FREQ+1, and are left for the caller to erase once
+ * every seed has been added.
+ */
+static void AddKmerSeeds(uint8_t *seeds, size_t numseeds, KmerCountMap& kmermap)
+{
+    constexpr size_t seedbytes = KMER_SEED_BYTES;
+
+#if SORT_COUNTING == 1
+    /*
+     * Sort the seeds by k-mer, so that all the seeds of a k-mer are adjacent
+     * and each k-mer is looked up once per run rather than once per seed.
+     */
+    RadixSortRecords(seeds, numseeds, seedbytes, TKmer::N_BYTES / 8);
+#else
+    static_assert(SORT_COUNTING == 0);
+#endif
+
+    /*
+     * Each thread adds the seeds of one shard of the k-mers (see GetKmerShard),
+     * so every entry is only ever updated by one thread, and it gets its seeds
+     * in the same order as with a single thread.
+     */
+    int numshards = GetNumThreads();
+    KmerShards shards;
+
+    if (numshards > 1)
+        shards = GetKmerShards(seeds, numseeds, seedbytes, numshards);
+
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int s = 0; s < numshards; ++s)
+    {
+        KmerEntryFinder findentry(kmermap);
+
+        ForeachShardRecord(shards, numseeds, s, [&](size_t i)
+        {
+            const uint8_t *addrs2read = seeds + i * seedbytes;
+
+            KmerCountEntry *entry = shards.empty()? findentry(addrs2read) : findentry(addrs2read, shards.hashes[i]);
+            ReadId readid = *((ReadId*)(addrs2read + TKmer::N_BYTES));
+            PosInRead pos = *((PosInRead*)(addrs2read + TKmer::N_BYTES + sizeof(ReadId)));
+
+            if (!entry)
+                return;
+
+            READIDS& readids      = std::get<0>(*entry);
+            POSITIONS& positions  = std::get<1>(*entry);
+            int& count            = std::get<2>(*entry);
+
+            if (count >= UPPER_KMER_FREQ)
+            {
+                count = UPPER_KMER_FREQ + 1;
+                return;
+            }
+
+            readids[count] = readid;
+            positions[count] = pos;
+
+            count++;
+        });
+    }
+}
+#endif
+
+#if SEED_BATCH_MB > 0
+/*
+ * Parses, exchanges, and adds the seeds of the local reads to @kmermap in
+ * batches of at most SEED_BATCH_MB megabytes of outgoing seeds (a single read
+ * that is larger than that still makes up a batch on its own). Two batches are
+ * in flight at a time: the next batch is parsed and its MPI_Ialltoallv posted
+ * before waiting on the current one. Returns the number of received seeds.
+ */
+static size_t AddKmerSeedsInBatches(const ReadStore& myreads, KmerCountMap& kmermap, SharedPtr<CommGrid> commgrid)
+{
+    std::unique_ptr<std::ostringstream> logstream;
+
+    int nprocs = commgrid->GetSize();
+    size_t numreads = myreads.size();
+    ReadId readoffset = GetReadOffset(numreads, commgrid);
+
+#if COMPACT_SEEDS == 1
+    Vector<ReadId> readoffsets = GetReadOffsets(numreads, commgrid);
+#endif
+
+    constexpr size_t seedbytes = SEED_WIRE_BYTES;
+    constexpr size_t batchbytes = static_cast<size_t>(SEED_BATCH_MB) * 1024 * 1024;
+
+    /*
+     * Split the local reads into consecutive ranges whose seeds fit in the budget.
+     */
+    Vector<size_t> batchstarts = {0};
+    size_t batchseeds = 0;
+
+    for (size_t i = 0; i < numreads; ++i)
+    {
+        size_t readseeds = GetMaxNumSeeds(myreads, i, i+1);
+
+        if (batchseeds && (batchseeds + readseeds) * seedbytes > batchbytes)
+        {
+            batchstarts.push_back(i);
+            batchseeds = 0;
+        }
+
+        batchseeds += readseeds;
+    }
+
+    batchstarts.push_back(numreads);
+
+    /*
+     * Every processor takes part in every exchange, processors that
+     * run out of reads early just send empty batches.
+     */
+    size_t mybatches = batchstarts.size() - 1;
+    size_t numbatches;
+
+    MPI_Allreduce(&mybatches, &numbatches, 1, MPI_SIZE_T, MPI_MAX, commgrid->GetWorld());
+
+    struct SeedBatch
+    {
+        Vector<MPI_Count_type> sendcnt, recvcnt;
+        Vector<MPI_Displ_type> sdispls, rdispls;
+        Vector<uint8_t> sendbuf, recvbuf;
+        MPI_Request request;
+    };
+
+    /*
+     * Parses batch @b into @batch and posts its exchange.
+     */
+    auto postbatch = [&](size_t b, SeedBatch& batch)
+    {
+        size_t first = batchstarts[std::min(b, mybatches)];
+        size_t last = batchstarts[std::min(b+1, mybatches)];
+
+        batch.sendcnt.resize(nprocs);
+        batch.recvcnt.resize(nprocs);
+        batch.sdispls.resize(nprocs);
+        batch.rdispls.resize(nprocs);
+
+        PackKmerSeeds(myreads, first, last, readoffset, batch.sendbuf, batch.sendcnt, batch.sdispls, commgrid);
+
+        ExchangePlan plan(PROFILE_EXCHANGE2);
+        ExchangeCounts(batch.sendcnt, batch.recvcnt, plan, commgrid);
+
+        batch.rdispls.front() = 0;
+        std::partial_sum(batch.recvcnt.begin(), batch.recvcnt.end()-1, batch.rdispls.begin()+1);
+
+        size_t totrecv = batch.rdispls.back() + batch.recvcnt.back();
+
+#if COMPACT_SEEDS == 1
+        batch.recvbuf.reserve((totrecv / SEED_WIRE_BYTES) * KMER_SEED_BYTES);
+#endif
+        batch.recvbuf.resize(totrecv);
+
+#if HIERARCHICAL_EXCHANGE == 1
+        /*
+         * The two stages of the hierarchical exchange depend on each other,
+         * so it is done right away, and the batches don't overlap.
+         */
+        ExchangeBytes(batch.sendbuf.data(), batch.sendcnt, batch.sdispls, batch.recvbuf.data(), batch.recvcnt, batch.rdispls, plan, commgrid);
+        batch.request = MPI_REQUEST_NULL;
+#else
+        static_assert(HIERARCHICAL_EXCHANGE == 0);
+
+        MPI_IALLTOALLV(batch.sendbuf.data(), batch.sendcnt.data(), batch.sdispls.data(), MPI_BYTE,
+                       batch.recvbuf.data(), batch.recvcnt.data(), batch.rdispls.data(), MPI_BYTE,
+                       commgrid->GetWorld(), &batch.request);
+
+        ProfileAlltoall(PROFILE_EXCHANGE2, batch.sendcnt, batch.recvcnt);
+#endif
+    };
+
+    SeedBatch batches[2];
+    size_t numkmerseeds = 0;
+
+    postbatch(0, batches[0]);
+
+    for (size_t b = 0; b < numbatches; ++b)
+    {
+        SeedBatch& batch = batches[b & 1];
+
+        if (b + 1 < numbatches)
+            postbatch(b + 1, batches[(b + 1) & 1]);
+
+        MPI_Wait(&batch.request, MPI_STATUS_IGNORE);
+
+#if COMPACT_SEEDS == 1
+        UnpackKmerSeeds(batch.recvbuf, batch.rdispls, readoffsets);
+#endif
+
+        size_t numseeds = batch.recvbuf.size() / KMER_SEED_BYTES;
+        AddKmerSeeds(batch.recvbuf.data(), numseeds, kmermap);
+        numkmerseeds += numseeds;
+    }
+
+    logstream.reset(new std::ostringstream());
+    *logstream << "received a total of " << numkmerseeds << " 'row' k-mers in " << numbatches << " batches of the second ALLTOALL exchange";
+    LogAll(logstream->str(), commgrid);
+
+    return numkmerseeds;
+}
+#endif
+
+#if CSR_SEEDS == 1
+void GetKmerCountMapValues(const ReadStore& myreads, KmerCountMap& kmermap, KmerSeedBuffer& seedbuf, SharedPtr<CommGrid> commgrid)
+#else
+void GetKmerCountMapValues(const ReadStore& myreads, KmerCountMap& kmermap, SharedPtr<CommGrid> commgrid)
+#endif
+{
+    std::unique_ptr<std::ostringstream> logstream;
+    PhaseTimer exchangetimer(PROFILE_EXCHANGE2);
+    size_t numkmerseeds;
+
+#if SEED_BATCH_MB > 0
+    numkmerseeds = AddKmerSeedsInBatches(myreads, kmermap, commgrid);
+#else
+    static_assert(SEED_BATCH_MB == 0);
+
+    int nprocs = commgrid->GetSize();
+    size_t numreads = myreads.size();
+
+#if FUSED_KMER_PASS == 1
+    /*
+     * The seeds were already parsed and bucketed by GetKmerCountMapKeys.
+     */
+    assert(seedbuckets != nullptr);
+#else
+    static_assert(FUSED_KMER_PASS == 0);
+#endif
 
     Vector<MPI_Count_type> sendcnt(nprocs);
     Vector<MPI_Count_type> recvcnt(nprocs);
     Vector<MPI_Displ_type> sdispls(nprocs);
     Vector<MPI_Displ_type> rdispls(nprocs);
 
-    constexpr size_t seedbytes = TKmer::N_BYTES + sizeof(ReadId) + sizeof(PosInRead);
-
     logstream.reset(new std::ostringstream());
     *logstream << std::setprecision(4) << "sending 'row' k-mers to each processor in this amount (megabytes): {";
 
+#if FUSED_KMER_PASS == 1
+    for (int i = 0; i < nprocs; ++i)
+        sendcnt[i] = (*seedbuckets)[i].size();
+
+    GetSendDispls(sendcnt, sdispls, commgrid);
+#else
+    Vector<uint8_t> sendbuf;
+    PackKmerSeeds(myreads, 0, numreads, GetReadOffset(numreads, commgrid), sendbuf, sendcnt, sdispls, commgrid);
+#endif
+
     for (int i = 0; i < nprocs; ++i)
-    {
-        sendcnt[i] = kmerseeds[i].size() * seedbytes;
         *logstream << (static_cast<double>(sendcnt[i]) / (1024 * 1024)) << ",";
-    }
 
     *logstream << "}";
     LogAll(logstream->str(), commgrid);
 
-    MPI_ALLTOALL(sendcnt.data(), 1, MPI_COUNT_TYPE, recvcnt.data(), 1, MPI_COUNT_TYPE, commgrid->GetWorld());
-
-    sdispls.front() = rdispls.front() = 0;
+    ExchangePlan plan(PROFILE_EXCHANGE2);
+    ExchangeCounts(sendcnt, recvcnt, plan, commgrid);
 
-    std::partial_sum(sendcnt.begin(), sendcnt.end()-1, sdispls.begin()+1);
+    rdispls.front() = 0;
     std::partial_sum(recvcnt.begin(), recvcnt.end()-1, rdispls.begin()+1);
 
-    size_t totsend = std::accumulate(sendcnt.begin(), sendcnt.end(), 0);
-    size_t totrecv = std::accumulate(recvcnt.begin(), recvcnt.end(), 0);
+    size_t totrecv = std::accumulate(recvcnt.begin(), recvcnt.end(), static_cast<size_t>(0));
 
+#if FUSED_KMER_PASS == 1
+    size_t totsend = std::accumulate(sendcnt.begin(), sendcnt.end(), static_cast<size_t>(0));
     Vector<uint8_t> sendbuf(totsend, 0);
 
     for (int i = 0; i < nprocs; ++i)
     {
-        assert(kmerseeds[i].size() == (sendcnt[i] / seedbytes));
+        std::memcpy(sendbuf.data() + sdispls[i], (*seedbuckets)[i].data(), sendcnt[i]);
+        Vector<uint8_t>().swap((*seedbuckets)[i]);
+    }
 
-        uint8_t *addrs2fill = sendbuf.data() + sdispls[i];
+    delete seedbuckets;
+    seedbuckets = nullptr;
+#endif
 
-        for (MPI_Count_type j = 0; j < kmerseeds[i].size(); ++j)
-        {
-            auto& seeditr = kmerseeds[i][j];
-            TKmer kmer = std::get<0>(seeditr);
-            ReadId readid = std::get<1>(seeditr);
-            PosInRead pos = std::get<2>(seeditr);
-            memcpy(addrs2fill, kmer.GetBytes(), TKmer::N_BYTES);
-            memcpy(addrs2fill + TKmer::N_BYTES, &readid, sizeof(ReadId));
-            memcpy(addrs2fill + TKmer::N_BYTES + sizeof(ReadId), &pos, sizeof(PosInRead));
-            addrs2fill += seedbytes;
-        }
+    Vector<uint8_t> recvbuf;
 
-        kmerseeds[i].clear();
-    }
+#if COMPACT_SEEDS == 1
+    recvbuf.reserve((totrecv / SEED_WIRE_BYTES) * KMER_SEED_BYTES);
+#endif
+    recvbuf.resize(totrecv);
 
-    Vector<uint8_t> recvbuf(totrecv, 0);
+    ExchangeBytes(sendbuf.data(), sendcnt, sdispls, recvbuf.data(), recvcnt, rdispls, plan, commgrid);
 
-    MPI_ALLTOALLV(sendbuf.data(), sendcnt.data(), sdispls.data(), MPI_BYTE, recvbuf.data(), recvcnt.data(), rdispls.data(), MPI_BYTE, commgrid->GetWorld());
+    numkmerseeds = totrecv / SEED_WIRE_BYTES;
 
-    size_t numkmerseeds = totrecv / seedbytes;
+#if COMPACT_SEEDS == 1
+    Vector<uint8_t>().swap(sendbuf);
+    UnpackKmerSeeds(recvbuf, rdispls, GetReadOffsets(numreads, commgrid));
+#endif
 
     logstream.reset(new std::ostringstream());
     *logstream << "received a total of " << numkmerseeds << " 'row' k-mers in second ALLTOALL exchange";
     LogAll(logstream->str(), commgrid);
 
+
+#if CSR_SEEDS == 1
+    constexpr size_t seedbytes = KMER_SEED_BYTES;
+
+#if SORT_COUNTING == 1
+    /*
+     * Sort the received seeds by k-mer, so that all the seeds of a k-mer are
+     * adjacent and each k-mer is looked up once per run rather than once per seed.
+     */
+    RadixSortRecords(recvbuf.data(), numkmerseeds, seedbytes, TKmer::N_BYTES / 8);
+#else
+    static_assert(SORT_COUNTING == 0);
+#endif
+
+    KmerEntryFinder findentry(kmermap);
     uint8_t *addrs2read = recvbuf.data();
 
+    /*
+     * First sweep: count the occurrences of each k-mer. The k-mer bytes of a
+     * received seed aren't needed once its entry has been found, so they are
+     * overwritten with a pointer to the entry (or nullptr), which saves the
+     * second sweep from hashing and probing again.
+     */
+    static_assert(sizeof(KmerCountEntry*) <= TKmer::N_BYTES);
+
     for (size_t i = 0; i < numkmerseeds; ++i)
     {
-        TKmer kmer(addrs2read);
+        KmerCountEntry *entry = findentry(addrs2read);
 
-#if USE_BLOOM == 1
-        if (!bm->Check(kmer.GetBytes(), TKmer::N_BYTES))
-            continue;
-#else
-        static_assert(USE_BLOOM == 0);
-#endif
+        if (entry) std::get<2>(*entry)++;
 
-        ReadId readid = *((ReadId*)(addrs2read + TKmer::N_BYTES));
-        PosInRead pos = *((PosInRead*)(addrs2read + TKmer::N_BYTES + sizeof(ReadId)));
+        std::memcpy(addrs2read, &entry, sizeof(entry));
         addrs2read += seedbytes;
+    }
+
+    /*
+     * Drop the k-mers above the upper bound and prefix-sum the counts of the
+     * reliable ones into offsets within the occurrence buffer. k-mers below
+     * the lower bound get no storage (their count is kept so the caller can
+     * still tell them apart). Erased entries are reset, and so have no storage
+     * either. Note that the entries must not move until the second sweep is
+     * done, so the dense array isn't compacted here.
+     */
+    size_t numoccurrences = 0;
 
-        auto kmitr = kmermap.find(kmer);
+    for (auto itr = kmermap.begin(); itr != kmermap.end(); )
+    {
+        int count = std::get<2>(itr->second);
 
-        if (kmitr == kmermap.end())
+        if (count > UPPER_KMER_FREQ)
+        {
+            itr = kmermap.erase(itr);
             continue;
+        }
 
-        KmerCountEntry& entry = kmitr->second;
+        if (count >= LOWER_KMER_FREQ)
+            numoccurrences += count;
 
-        READIDS& readids      = std::get<0>(entry);
-        POSITIONS& positions  = std::get<1>(entry);
-        int& count            = std::get<2>(entry);
+        ++itr;
+    }
 
-        if (count >= UPPER_KMER_FREQ) /* TODO: There is probably a more efficient solution: deleting k-mer from kmermap (?) */
-        {
-            kmermap.erase(kmer);
+    seedbuf.readids.resize(numoccurrences);
+    seedbuf.positions.resize(numoccurrences);
+
+    size_t offset = 0;
+
+    for (auto itr = kmermap.begin(); itr != kmermap.end(); ++itr)
+    {
+        KmerCountEntry& entry = itr->second;
+        int& count = std::get<2>(entry);
+
+        if (count < LOWER_KMER_FREQ)
             continue;
-        }
+
+        std::get<0>(entry) = seedbuf.readids.data() + offset;
+        std::get<1>(entry) = seedbuf.positions.data() + offset;
+
+        offset += count;
+        count = 0; /* becomes the fill cursor */
+    }
+
+    assert(offset == numoccurrences);
+
+    /*
+     * Second sweep: fill in the read ids and positions.
+     */
+    addrs2read = recvbuf.data();
+
+    for (size_t i = 0; i < numkmerseeds; ++i)
+    {
+        KmerCountEntry *entry;
+        std::memcpy(&entry, addrs2read, sizeof(entry));
+
+        ReadId readid = *((ReadId*)(addrs2read + TKmer::N_BYTES));
+        PosInRead pos = *((PosInRead*)(addrs2read + TKmer::N_BYTES + sizeof(ReadId)));
+        addrs2read += seedbytes;
+
+        if (!entry || !std::get<0>(*entry))
+            continue;
+
+        READIDS& readids      = std::get<0>(*entry);
+        POSITIONS& positions  = std::get<1>(*entry);
+        int& count            = std::get<2>(*entry);
 
         readids[count] = readid;
         positions[count] = pos;
 
         count++;
     }
+#else
+    static_assert(CSR_SEEDS == 0);
+
+    AddKmerSeeds(recvbuf.data(), numkmerseeds, kmermap);
+#endif
+#endif
+
+#if CSR_SEEDS == 0
+    /*
+     * Erase the k-mers that AddKmerSeeds marked as seen more than UPPER_KMER_FREQ times.
+     */
+    kmermap.erase_if([](const auto& entry) { return std::get<2>(entry.second) > UPPER_KMER_FREQ; });
+#endif
 
     logstream.reset(new std::ostringstream());
     *logstream << numkmerseeds;
 
 #if USE_BLOOM == 1
     *logstream << " row k-mers filtered by Bloom filter, hash table, and upper k-mer bound threshold into " << kmermap.size() << " semi-reliable 'column' k-mers";
-    delete bm;
+
+    for (KmerBloom *bm : bms)
+        delete bm;
+
+    bms.clear();
 #else
     static_assert(USE_BLOOM == 0);
     *logstream << " row k-mers filtered by hash table and upper k-mer bound threshold into " << kmermap.size() << " semi-reliable 'column' k-mers";
@@ -419,11 +1483,69 @@ void GetKmerCountMapValues(const Vector<String>& myreads, KmerCountMap& kmermap,
     LogAll(logstream->str(), commgrid);
 }
 
+SkewAwareKmerPartitioner::SkewAwareKmerPartitioner(int nprocs, size_t maxnumseeds) : numdropped(0), nprocs(nprocs)
+{
+    /*
+     * With rows 8 times narrower than the number of seeds, a counter
+     * overestimates a k-mer's count by about 8 on average (less so for
+     * the smallest of the rows).
+     */
+    size_t width = 1024;
+
+    while (width * 8 < maxnumseeds)
+        width <<= 1;
+
+    mask = width - 1;
+    sketch.assign(SKETCH_ROWS * width, 0);
+}
+
+int SkewAwareKmerPartitioner::operator()(const THashedKmer& hmer)
+{
+    int owner = GetKmerOwner(hmer, nprocs);
+
+    uint64_t h1 = hmer.hash, h2;
+    wang_hash_64bits(&h1, &h2);
+
+    int estimate = std::numeric_limits<uint16_t>::max();
+
+    for (int r = 0; r < SKETCH_ROWS; ++r)
+    {
+        uint16_t& counter = sketch[r * (mask + 1) + ((h1 + r * h2) & mask)];
+
+        if (counter < std::numeric_limits<uint16_t>::max())
+            counter++;
+
+        estimate = std::min(estimate, static_cast<int>(counter));
+    }
+
+    if (estimate <= UPPER_KMER_FREQ + 1)
+        return owner;
+
+    int& count = candidates.try_emplace(hmer.kmer, hmer.hash).first->second;
+
+    if (++count <= UPPER_KMER_FREQ + 1)
+        return owner;
+
+    numdropped++;
+    return -1;
+}
+
 int GetKmerOwner(const TKmer& kmer, int nprocs)
 {
-    uint64_t myhash = kmer.GetHash();
+    return GetKmerOwner(kmer.GetHash(), nprocs);
+}
+
+int GetKmerOwner(const THashedKmer& kmer, int nprocs)
+{
+    return GetKmerOwner(kmer.hash, nprocs);
+}
+
+int GetKmerOwner(uint64_t myhash, int nprocs)
+{
     double range = static_cast<double>(myhash) * static_cast<double>(nprocs);
     size_t owner = range / std::numeric_limits<uint64_t>::max();
     assert(owner >= 0 && owner < static_cast<int>(nprocs));
     return static_cast<int>(owner);
 }
+
+} /* namespace PIPELINE_NAMESPACE */
@@ -1,7 +1,10 @@
 #include "Logger.h"
+#include "Profiler.h"
 
 void LogAll(const String mylog, SharedPtr<CommGrid> commgrid)
 {
+    PhaseTimer logtimer(PROFILE_LOG);
+
     int myrank = commgrid->GetRank();
     int nprocs = commgrid->GetSize();
     MPI_Comm comm = commgrid->GetWorld();
@@ -24,6 +27,7 @@ void LogAll(const String mylog, SharedPtr<CommGrid> commgrid)
     }
 
     MPI_Gatherv(mylog.c_str(), sendcnt, MPI_CHAR, recvbuf.data(), recvcnt.data(), displs.data(), MPI_CHAR, 0, comm);
+    ProfileCollective(PROFILE_LOG, sendcnt, recvbuf.size());
 
     if (!myrank)
     {
@@ -0,0 +1,153 @@
+#include "OverlapFile.h"
+#include <zlib.h>
+#include <cstring>
+#include <iostream>
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "B.bin is written in host byte order");
+static_assert(sizeof(OverlapFileHeader) == 48);
+
+template <class NT>
+void WriteOverlapFile(SpParMat<uint64_t, NT, SpDCCols<uint64_t, NT>>& B, const String& fname, bool compress)
+{
+    auto commgrid = B.getcommgrid();
+
+    int myrank = commgrid->GetRank();
+    int nprocs = commgrid->GetSize();
+
+    /*
+     * The global ids of the tile's first row and column are the numbers of
+     * rows and columns of the tiles above it and to its left.
+     */
+    uint64_t locrows = B.seq().getnrow(), rowoffset = 0;
+    uint64_t loccols = B.seq().getncol(), coloffset = 0;
+
+    MPI_Exscan(&locrows, &rowoffset, 1, MPI_UINT64_T, MPI_SUM, commgrid->GetColWorld());
+    MPI_Exscan(&loccols, &coloffset, 1, MPI_UINT64_T, MPI_SUM, commgrid->GetRowWorld());
+
+    if (!commgrid->GetRankInProcCol()) rowoffset = 0;
+    if (!commgrid->GetRankInProcRow()) coloffset = 0;
+
+    uint64_t mynnz = B.seq().getnnz();
+
+    Vector<uint64_t> rows, cols;
+    Vector<uint32_t> counts;
+    Array<Vector<uint16_t>, 4> seeds; /* begQs[0], begTs[0], begQs[1], begTs[1] */
+
+    rows.reserve(mynnz);
+    cols.reserve(mynnz);
+    counts.reserve(mynnz);
+
+    for (auto& column : seeds)
+        column.reserve(mynnz);
+
+    for (auto colit = B.seq().begcol(); colit != B.seq().endcol(); ++colit)
+    {
+        for (auto nzit = B.seq().begnz(colit); nzit != B.seq().endnz(colit); ++nzit)
+        {
+            const NT& o = nzit.value();
+
+            rows.push_back(nzit.rowid() + rowoffset);
+            cols.push_back(colit.colid() + coloffset);
+            counts.push_back(static_cast<uint32_t>(o.count));
+
+            seeds[0].push_back(o.begQs[0]);
+            seeds[1].push_back(o.begTs[0]);
+            seeds[2].push_back(o.begQs[1]);
+            seeds[3].push_back(o.begTs[1]);
+        }
+    }
+
+    mynnz = rows.size();
+
+    uint64_t totnnz = 0, mynnzoffset = 0;
+
+    MPI_Allreduce(&mynnz, &totnnz, 1, MPI_UINT64_T, MPI_SUM, commgrid->GetWorld());
+    MPI_Exscan(&mynnz, &mynnzoffset, 1, MPI_UINT64_T, MPI_SUM, commgrid->GetWorld());
+    if (!myrank) mynnzoffset = 0;
+
+    OverlapFileHeader header = {};
+
+    std::memcpy(header.magic, "ELBAOVL", 8);
+    header.version = 1;
+    header.compressed = compress;
+    header.numrows = B.getnrow();
+    header.numcols = B.getncol();
+    header.numnonzeros = totnnz;
+    header.numblocks = compress? nprocs : 0;
+
+    MPI_File fh;
+
+    if (MPI_File_open(commgrid->GetWorld(), fname.c_str(), MPI_MODE_WRONLY | MPI_MODE_CREATE, MPI_INFO_NULL, &fh) != MPI_SUCCESS)
+    {
+        if (!myrank) std::cerr << "could not open " << fname << " for writing" << std::endl;
+        return;
+    }
+
+    MPI_File_set_size(fh, 0);
+
+    MPI_FILE_WRITE_AT_ALL(fh, 0, &header, myrank? 0 : sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE);
+
+    MPI_Offset offset = sizeof(header);
+
+    if (!compress)
+    {
+        /*
+         * Every array is written at its offset in the file plus the number of
+         * nonzeros of the processors before this one.
+         */
+        auto writecolumn = [&](const auto& column, MPI_Datatype type)
+        {
+            constexpr size_t width = sizeof(column[0]);
+            MPI_FILE_WRITE_AT_ALL(fh, offset + mynnzoffset * width, column.data(), column.size(), type, MPI_STATUS_IGNORE);
+            offset += totnnz * width;
+        };
+
+        writecolumn(rows, MPI_UINT64_T);
+        writecolumn(cols, MPI_UINT64_T);
+        writecolumn(counts, MPI_UINT32_T);
+
+        for (const auto& column : seeds)
+            writecolumn(column, MPI_UINT16_T);
+    }
+    else
+    {
+        Vector<uint8_t> columns;
+        columns.reserve(mynnz * (2 * sizeof(uint64_t) + sizeof(uint32_t) + 4 * sizeof(uint16_t)));
+
+        auto appendcolumn = [&columns](const auto& column)
+        {
+            const uint8_t *bytes = reinterpret_cast<const uint8_t*>(column.data());
+            columns.insert(columns.end(), bytes, bytes + column.size() * sizeof(column[0]));
+        };
+
+        appendcolumn(rows);
+        appendcolumn(cols);
+        appendcolumn(counts);
+
+        for (const auto& column : seeds)
+            appendcolumn(column);
+
+        uLongf blocksize = compressBound(columns.size());
+        Vector<uint8_t> block(blocksize);
+
+        if (compress2(block.data(), &blocksize, columns.data(), columns.size(), Z_DEFAULT_COMPRESSION) != Z_OK)
+        {
+            std::cerr << "processor " << myrank << " failed to compress its overlaps" << std::endl;
+            MPI_Abort(commgrid->GetWorld(), 1);
+        }
+
+        block.resize(blocksize);
+
+        uint64_t entry[2] = {mynnz, blocksize}, blockoffset = 0, myblocksize = blocksize;
+
+        MPI_Exscan(&myblocksize, &blockoffset, 1, MPI_UINT64_T, MPI_SUM, commgrid->GetWorld());
+        if (!myrank) blockoffset = 0;
+
+        MPI_FILE_WRITE_AT_ALL(fh, offset + myrank * sizeof(entry), entry, 2, MPI_UINT64_T, MPI_STATUS_IGNORE);
+        offset += nprocs * sizeof(entry);
+
+        MPI_FILE_WRITE_AT_ALL(fh, offset + blockoffset, block.data(), block.size(), MPI_BYTE, MPI_STATUS_IGNORE);
+    }
+
+    MPI_File_close(&fh);
+}
@@ -0,0 +1,45 @@
+#include "Pipeline.h"
+#include <sstream>
+#include <algorithm>
+
+static Vector<Pipeline>& GetRegistry()
+{
+    /*
+     * Constructed on first use, because the registrars run during static
+     * initialization, in no particular order across translation units.
+     */
+    static Vector<Pipeline> registry;
+    return registry;
+}
+
+bool PipelineConfig::Matches(const PipelineConfig& query) const
+{
+    return (query.kmersize  < 0 || query.kmersize  == kmersize)  &&
+           (query.lowerfreq < 0 || query.lowerfreq == lowerfreq) &&
+           (query.upperfreq < 0 || query.upperfreq == upperfreq) &&
+           (query.usebloom  < 0 || query.usebloom  == usebloom);
+}
+
+bool PipelineConfig::operator<(const PipelineConfig& o) const
+{
+    return std::tie(kmersize, lowerfreq, upperfreq, usebloom) < std::tie(o.kmersize, o.lowerfreq, o.upperfreq, o.usebloom);
+}
+
+String PipelineConfig::GetString() const
+{
+    std::ostringstream ss;
+    ss << "-k " << kmersize << " -l " << lowerfreq << " -u " << upperfreq << " -b " << usebloom;
+    return ss.str();
+}
+
+Vector<Pipeline> GetPipelines()
+{
+    Vector<Pipeline> pipelines = GetRegistry();
+    std::sort(pipelines.begin(), pipelines.end(), [](const Pipeline& a, const Pipeline& b) { return a.config < b.config; });
+    return pipelines;
+}
+
+PipelineRegistrar::PipelineRegistrar(const PipelineConfig& config, PipelineFunc run)
+{
+    GetRegistry().push_back({config, run});
+}
@@ -0,0 +1,113 @@
+#include "Profiler.h"
+#include <sys/resource.h>
+#include <fstream>
+#include <iomanip>
+
+static const char *phasenames[NUM_PROFILE_PHASES] =
+{
+    "total", "parse", "hll", "exchange-1", "insert", "exchange-2", "matrix", "spgemm", "write", "log"
+};
+
+/*
+ * The totals of one phase on this processor, all as doubles so that they
+ * are reduced together.
+ */
+struct PhaseProfile
+{
+    double seconds;
+    double collectives;
+    double sentbytes;
+    double recvbytes;
+    double peakrss;     /* megabytes, at the end of the phase */
+};
+
+static constexpr int NUM_PROFILE_FIELDS = sizeof(PhaseProfile) / sizeof(double);
+
+static PhaseProfile profiles[NUM_PROFILE_PHASES];
+
+static double GetPeakRSS()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+#ifdef __APPLE__
+    return usage.ru_maxrss / (1024.0 * 1024.0); /* bytes */
+#else
+    return usage.ru_maxrss / 1024.0; /* kilobytes */
+#endif
+}
+
+PhaseTimer::PhaseTimer(ProfilePhase phase) : phase(phase), start(MPI_Wtime()), running(true) {}
+
+PhaseTimer::~PhaseTimer()
+{
+    Stop();
+}
+
+void PhaseTimer::Stop()
+{
+    if (!running) return;
+
+    profiles[phase].seconds += MPI_Wtime() - start;
+    profiles[phase].peakrss = GetPeakRSS();
+    running = false;
+}
+
+void ProfileCollective(ProfilePhase phase, uint64_t sentbytes, uint64_t recvbytes)
+{
+    profiles[phase].collectives += 1;
+    profiles[phase].sentbytes += sentbytes;
+    profiles[phase].recvbytes += recvbytes;
+}
+
+static void WriteStats(std::ostream& os, const char *name, double min, double sum, double max, int nprocs)
+{
+    double mean = sum / nprocs;
+
+    os << "\"" << name << "\": {\"min\": " << min << ", \"mean\": " << mean << ", \"max\": " << max
+       << ", \"imbalance\": " << (mean > 0? max / mean : 1.0) << "}";
+}
+
+void WriteProfile(const String& fname, const PipelineConfig& config, SharedPtr<CommGrid> commgrid)
+{
+    int myrank = commgrid->GetRank();
+    int nprocs = commgrid->GetSize();
+
+    constexpr int count = NUM_PROFILE_PHASES * NUM_PROFILE_FIELDS;
+
+    const double *mine = &profiles[0].seconds;
+    Vector<double> mins(count), sums(count), maxs(count);
+
+    MPI_Reduce(mine, mins.data(), count, MPI_DOUBLE, MPI_MIN, 0, commgrid->GetWorld());
+    MPI_Reduce(mine, sums.data(), count, MPI_DOUBLE, MPI_SUM, 0, commgrid->GetWorld());
+    MPI_Reduce(mine, maxs.data(), count, MPI_DOUBLE, MPI_MAX, 0, commgrid->GetWorld());
+
+    if (myrank) return;
+
+    static const char *fieldnames[NUM_PROFILE_FIELDS] = {"seconds", "collectives", "sent_bytes", "received_bytes", "peak_rss_mb"};
+
+    std::ofstream os(fname);
+    os << std::setprecision(12);
+
+    os << "{\n"
+       << "  \"nprocs\": " << nprocs << ",\n"
+       << "  \"pipeline\": {\"kmer_size\": " << config.kmersize << ", \"lower_kmer_freq\": " << config.lowerfreq
+       << ", \"upper_kmer_freq\": " << config.upperfreq << ", \"use_bloom\": " << config.usebloom << "},\n"
+       << "  \"phases\": [\n";
+
+    for (int p = 0; p < NUM_PROFILE_PHASES; ++p)
+    {
+        os << "    {\"name\": \"" << phasenames[p] << "\"";
+
+        for (int f = 0; f < NUM_PROFILE_FIELDS; ++f)
+        {
+            int i = p * NUM_PROFILE_FIELDS + f;
+            os << ", ";
+            WriteStats(os, fieldnames[f], mins[i], sums[i], maxs[i], nprocs);
+        }
+
+        os << "}" << (p+1 < NUM_PROFILE_PHASES? "," : "") << "\n";
+    }
+
+    os << "  ]\n}" << std::endl;
+}
@@ -0,0 +1,156 @@
+#include "RadixSort.h"
+#include <vector>
+#include <array>
+#include <cstring>
+#include <cassert>
+#include <algorithm>
+
+#ifndef USE_OPENMP
+#define USE_OPENMP 0 /* see KmerComm.h */
+#endif
+
+#if USE_OPENMP == 1
+#include <omp.h>
+#endif
+
+typedef std::array<size_t, 256> DigitHistogram;
+
+static inline uint8_t get_digit(const uint8_t *record, int word, int byte)
+{
+    uint64_t w;
+    std::memcpy(&w, record + 8 * word, sizeof(uint64_t));
+    return static_cast<uint8_t>((w >> (8 * byte)) & 0xff);
+}
+
+static int GetNumThreads()
+{
+#if USE_OPENMP == 1
+    return omp_get_max_threads();
+#else
+    static_assert(USE_OPENMP == 0);
+    return 1;
+#endif
+}
+
+static size_t GetChunkStart(size_t numrecs, int numchunks, int chunk)
+{
+    return (numrecs * chunk) / numchunks;
+}
+
+void RadixSortRecords(uint8_t *records, size_t numrecs, size_t recbytes, int keywords)
+{
+    assert(recbytes >= 8 * static_cast<size_t>(keywords));
+
+    if (numrecs <= 1) return;
+
+    int numdigits = 8 * keywords;
+    int numchunks = static_cast<int>(std::min(static_cast<size_t>(GetNumThreads()), numrecs));
+
+    /*
+     * Digit d = 0 is the least significant byte of the last key word,
+     * and d = numdigits-1 is the most significant byte of the first one.
+     *
+     * The records are split into one contiguous chunk per thread. In every
+     * pass, each thread counts the digits of its chunk and then moves its
+     * records to their digit's part of the output, after the records with
+     * the same digit of the chunks before it, which keeps the sort stable.
+     * The histograms of all the digits are computed in a single pass first,
+     * and are the ones of the first pass that isn't skipped.
+     */
+    std::vector<std::vector<DigitHistogram>> histos(numchunks, std::vector<DigitHistogram>(numdigits));
+
+    #pragma omp parallel for schedule(static, 1)
+    for (int c = 0; c < numchunks; ++c)
+    {
+        for (auto& histo : histos[c])
+            histo.fill(0);
+
+        for (size_t i = GetChunkStart(numrecs, numchunks, c); i < GetChunkStart(numrecs, numchunks, c+1); ++i)
+        {
+            const uint8_t *record = records + i * recbytes;
+
+            for (int d = 0; d < numdigits; ++d)
+            {
+                histos[c][d][get_digit(record, keywords - 1 - d / 8, d % 8)]++;
+            }
+        }
+    }
+
+    std::vector<uint8_t> tmp(numrecs * recbytes);
+
+    uint8_t *src = records;
+    uint8_t *dst = tmp.data();
+    bool moved = false;
+
+    for (int d = 0; d < numdigits; ++d)
+    {
+        int word = keywords - 1 - d / 8;
+        int byte = d % 8;
+
+        /*
+         * Nothing to do if every record has the same digit here (which doesn't
+         * depend on the order of the records, so the first histograms do).
+         */
+        DigitHistogram histo;
+        histo.fill(0);
+
+        for (int c = 0; c < numchunks; ++c)
+            for (int b = 0; b < 256; ++b)
+                histo[b] += histos[c][d][b];
+
+        if (std::find(histo.begin(), histo.end(), numrecs) != histo.end())
+            continue;
+
+        /*
+         * Once records have moved, the chunks hold other records, so their
+         * histograms of this digit are counted again.
+         */
+        if (moved)
+        {
+            #pragma omp parallel for schedule(static, 1)
+            for (int c = 0; c < numchunks; ++c)
+            {
+                histos[c][d].fill(0);
+
+                for (size_t i = GetChunkStart(numrecs, numchunks, c); i < GetChunkStart(numrecs, numchunks, c+1); ++i)
+                    histos[c][d][get_digit(src + i * recbytes, word, byte)]++;
+            }
+        }
+
+        std::vector<DigitHistogram> offsets(numchunks);
+        size_t offset = 0;
+
+        for (int b = 0; b < 256; ++b)
+        {
+            for (int c = 0; c < numchunks; ++c)
+            {
+                offsets[c][b] = offset;
+                offset += histos[c][d][b];
+            }
+        }
+
+        #pragma omp parallel for schedule(static, 1)
+        for (int c = 0; c < numchunks; ++c)
+        {
+            for (size_t i = GetChunkStart(numrecs, numchunks, c); i < GetChunkStart(numrecs, numchunks, c+1); ++i)
+            {
+                const uint8_t *record = src + i * recbytes;
+                std::memcpy(dst + (offsets[c][get_digit(record, word, byte)]++) * recbytes, record, recbytes);
+            }
+        }
+
+        std::swap(src, dst);
+        moved = true;
+    }
+
+    if (src != records)
+    {
+        #pragma omp parallel for schedule(static, 1)
+        for (int c = 0; c < numchunks; ++c)
+        {
+            size_t first = GetChunkStart(numrecs, numchunks, c);
+            size_t last = GetChunkStart(numrecs, numchunks, c+1);
+            std::memcpy(records + first * recbytes, src + first * recbytes, (last - first) * recbytes);
+        }
+    }
+}
@@ -0,0 +1,51 @@
+#include "ReadStore.h"
+#include <cassert>
+
+#if PACKED_READS == 1
+/*
+ * 2-bit code of @c, with anything other than A, C, G and T coded as A.
+ */
+static int GetBaseCode(char c)
+{
+    switch (c)
+    {
+        case 'A': case 'a': return 0;
+        case 'C': case 'c': return 1;
+        case 'G': case 'g': return 2;
+        case 'T': case 't': return 3;
+        default: return 0;
+    }
+}
+
+ReadStore::ReadStore(Vector<char>&& bases, Vector<size_t>&& offsets) : offsets(std::move(offsets))
+{
+    size_t numbases = GetTotalBases();
+
+    assert(numbases <= bases.size());
+
+    words.assign((numbases + 31) / 32, 0);
+
+    for (size_t i = 0; i < numbases; ++i)
+    {
+        int code = GetBaseCode(bases[i]);
+
+        words[i / 32] |= static_cast<uint64_t>(code) << (62 - 2 * (i % 32));
+    }
+
+    Vector<char>().swap(bases);
+}
+#else
+static_assert(PACKED_READS == 0);
+
+ReadStore::ReadStore(Vector<char>&& bases, Vector<size_t>&& offsets) : bases(std::move(bases)), offsets(std::move(offsets))
+{
+    assert(GetTotalBases() <= this->bases.size());
+
+    /*
+     * The arena usually starts out as the whole file chunk, of which only
+     * the bases are kept.
+     */
+    this->bases.resize(GetTotalBases());
+    this->bases.shrink_to_fit();
+}
+#endif
@@ -0,0 +1,411 @@
+#include "ReadStream.h"
+#include <zlib.h>
+#include <cstring>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+static constexpr size_t BGZF_HEADER_BYTES = 18;       /* gzip header with just the BC extra subfield */
+static constexpr size_t BGZF_MAX_BLOCK_BYTES = 65536;
+static constexpr MPI_Offset STREAM_READ_BYTES = 4 * 1024 * 1024; /* bytes read at a time past the end of a range */
+
+/*
+ * Size of the BGZF block whose first @avail bytes are at @block,
+ * or 0 if there isn't a BGZF block header there.
+ */
+static size_t GetBgzfBlockSize(const char *block, size_t avail)
+{
+    const uint8_t *h = reinterpret_cast<const uint8_t*>(block);
+
+    if (avail < 12 || h[0] != 31 || h[1] != 139 || h[2] != 8 || !(h[3] & 4))
+        return 0;
+
+    size_t xlen = h[10] | (h[11] << 8);
+
+    if (avail < 12 + xlen)
+        return 0;
+
+    /*
+     * Look for the BC subfield, which holds the block size minus one.
+     */
+    for (size_t i = 12; i + 4 <= 12 + xlen; )
+    {
+        size_t slen = h[i+2] | (h[i+3] << 8);
+
+        if (h[i] == 'B' && h[i+1] == 'C' && slen == 2 && i + 6 <= 12 + xlen)
+            return (h[i+4] | (h[i+5] << 8)) + 1;
+
+        i += 4 + slen;
+    }
+
+    return 0;
+}
+
+/*
+ * Appends the decompressed contents of the @bsize byte BGZF block at @block to @out.
+ */
+static void InflateBgzfBlock(const char *block, size_t bsize, Vector<char>& out)
+{
+    const uint8_t *b = reinterpret_cast<const uint8_t*>(block);
+
+    size_t xlen = b[10] | (b[11] << 8);
+    size_t isize = b[bsize-4] | (b[bsize-3] << 8) | (b[bsize-2] << 16) | (static_cast<size_t>(b[bsize-1]) << 24);
+    size_t oldsize = out.size();
+
+    out.resize(oldsize + isize);
+
+    /*
+     * zlib rejects a null output pointer even when there is nothing to
+     * write, which is the case for the empty block at the end of every
+     * BGZF file, and @out can still be empty then.
+     */
+    Bytef empty;
+
+    z_stream zs;
+    std::memset(&zs, 0, sizeof(zs));
+    inflateInit2(&zs, -15); /* raw deflate, the gzip header and trailer are skipped by hand */
+
+    zs.next_in = const_cast<Bytef*>(b + 12 + xlen);
+    zs.avail_in = bsize - 12 - xlen - 8;
+    zs.next_out = isize? reinterpret_cast<Bytef*>(out.data() + oldsize) : &empty;
+    zs.avail_out = isize;
+
+    int rc = inflate(&zs, Z_FINISH);
+    inflateEnd(&zs);
+
+    if (rc != Z_STREAM_END || zs.avail_out)
+    {
+        std::cerr << "corrupt BGZF block" << std::endl;
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+}
+
+/*
+ * Buffered reads of one file at arbitrary offsets.
+ */
+struct FileWindow
+{
+    MPI_File fh;
+    MPI_Offset filesize;
+    MPI_Offset begin;
+    Vector<char> buf;
+
+    FileWindow(MPI_File fh, MPI_Offset filesize) : fh(fh), filesize(filesize), begin(0) {}
+
+    /*
+     * Returns bytes [offset, offset+n) of the file, or as many of them
+     * as there are. The pointer is valid until the next call.
+     */
+    const char* Get(MPI_Offset offset, size_t n)
+    {
+        if (offset < begin || offset + static_cast<MPI_Offset>(n) > begin + static_cast<MPI_Offset>(buf.size()))
+        {
+            begin = offset;
+            buf.resize(std::max(static_cast<MPI_Offset>(0), std::min(std::max(static_cast<MPI_Offset>(n), STREAM_READ_BYTES), filesize - offset)));
+            MPI_FILE_READ_AT(fh, offset, buf.data(), buf.size(), MPI_CHAR, MPI_STATUS_IGNORE);
+        }
+
+        return buf.data() + (offset - begin);
+    }
+
+    size_t Avail(MPI_Offset offset) const { return static_cast<size_t>(std::max(static_cast<MPI_Offset>(0), filesize - offset)); }
+};
+
+/*
+ * The bytes parsed by one process. ReadOwn appends the bytes of the process's
+ * own range, and then every call to ReadMore appends some of the bytes after
+ * it, until the end of the file.
+ */
+class PlainSource
+{
+public:
+    PlainSource(MPI_File fh, MPI_Offset filesize, MPI_Offset begin, MPI_Offset end) : fh(fh), filesize(filesize), begin(begin), end(end), next(end) {}
+
+    bool AtFileStart() const { return begin == 0; }
+
+    void ReadOwn(Vector<char>& buf)
+    {
+        Append(buf, begin, end - begin);
+    }
+
+    bool ReadMore(Vector<char>& buf)
+    {
+        if (next >= filesize) return false;
+
+        MPI_Offset n = std::min(STREAM_READ_BYTES, filesize - next);
+
+        Append(buf, next, n);
+        next += n;
+
+        return true;
+    }
+
+private:
+    MPI_File fh;
+    MPI_Offset filesize, begin, end, next;
+
+    void Append(Vector<char>& buf, MPI_Offset offset, MPI_Offset n)
+    {
+        size_t oldsize = buf.size();
+        buf.resize(oldsize + n);
+        MPI_FILE_READ_AT(fh, offset, buf.data() + oldsize, n, MPI_CHAR, MPI_STATUS_IGNORE);
+    }
+};
+
+/*
+ * Same as PlainSource, but the process's own range is made of the BGZF
+ * blocks that start in its byte range, and the bytes are decompressed.
+ */
+class BgzfSource
+{
+public:
+    BgzfSource(MPI_File fh, MPI_Offset filesize, MPI_Offset begin, MPI_Offset end) : window(fh, filesize), end(end)
+    {
+        next = FindBlock(begin);
+        first = next;
+    }
+
+    bool AtFileStart() const { return first == 0; }
+
+    void ReadOwn(Vector<char>& buf)
+    {
+        while (next < end && ReadMore(buf))
+            ;
+    }
+
+    bool ReadMore(Vector<char>& buf)
+    {
+        if (next >= window.filesize) return false;
+
+        size_t bsize = GetBgzfBlockSize(window.Get(next, BGZF_MAX_BLOCK_BYTES), window.Avail(next));
+
+        if (!bsize || bsize > window.Avail(next))
+        {
+            std::cerr << "corrupt BGZF block at offset " << next << std::endl;
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+
+        InflateBgzfBlock(window.Get(next, bsize), bsize, buf);
+        next += bsize;
+
+        return true;
+    }
+
+private:
+    FileWindow window;
+    MPI_Offset end;   /* the process's own blocks start before this */
+    MPI_Offset next;  /* offset of the next block to decompress */
+    MPI_Offset first; /* offset of the process's first block */
+
+    /*
+     * Offset of the first BGZF block at or after @offset. A gzip header can
+     * show up inside compressed data by chance, so a header only counts if
+     * another one (or the end of the file) follows the block it starts.
+     */
+    MPI_Offset FindBlock(MPI_Offset offset)
+    {
+        for (; offset < window.filesize; ++offset)
+        {
+            size_t bsize = GetBgzfBlockSize(window.Get(offset, BGZF_HEADER_BYTES), window.Avail(offset));
+
+            if (!bsize || bsize > window.Avail(offset))
+                continue;
+
+            MPI_Offset after = offset + bsize;
+
+            if (after == window.filesize || GetBgzfBlockSize(window.Get(after, BGZF_HEADER_BYTES), window.Avail(after)))
+                return offset;
+        }
+
+        return window.filesize;
+    }
+};
+
+/*
+ * Parses the records that @source's process owns: the ones whose first byte
+ * follows a newline in its own range (or that start the file). Each one is
+ * read to its end even if that is past the range. The bases are moved to the
+ * front of the buffer as they are parsed, which then becomes the read arena.
+ */
+template <class Source>
+static ReadStore ParseReads(Source& source, bool fastq)
+{
+    Vector<char> buf;
+    Vector<size_t> offsets(1, 0);
+
+    source.ReadOwn(buf);
+
+    size_t ownend = buf.size();
+
+    /*
+     * Sets @eol to the end of the line at @pos, reading more if needed.
+     * Returns false if there is no line at @pos.
+     */
+    auto getline = [&](size_t pos, size_t& eol)
+    {
+        if (pos > buf.size()) return false;
+
+        for (size_t from = pos; ; )
+        {
+            auto newline = std::find(buf.begin() + from, buf.end(), '\n');
+
+            if (newline != buf.end())
+            {
+                eol = newline - buf.begin();
+                return true;
+            }
+
+            from = buf.size();
+
+            if (!source.ReadMore(buf))
+            {
+                eol = buf.size();
+                return pos < buf.size();
+            }
+        }
+    };
+
+    size_t pos = 0, eol = 0, numbases = 0;
+
+    if (!source.AtFileStart())
+    {
+        auto newline = std::find(buf.begin(), buf.begin() + ownend, '\n');
+        pos = newline == buf.begin() + ownend? ownend + 1 : (newline - buf.begin()) + 1;
+    }
+
+    auto addbases = [&](size_t first, size_t last)
+    {
+        std::memmove(buf.data() + numbases, buf.data() + first, last - first);
+        numbases += last - first;
+    };
+
+    if (fastq)
+    {
+        /*
+         * A record starts at a line beginning with '@' that is followed by a
+         * line beginning with '+' two lines later. Quality lines can begin
+         * with '@' too, but they are followed by a sequence line two lines later.
+         */
+        size_t seqend, plusend;
+
+        for (; pos <= ownend && getline(pos, eol); pos = eol + 1)
+            if (buf[pos] == '@' && getline(eol + 1, seqend) && getline(seqend + 1, plusend) && buf[seqend + 1] == '+')
+                break;
+
+        while (pos <= ownend && getline(pos, eol) && buf[pos] == '@')
+        {
+            size_t seqbegin = eol + 1, qualend;
+
+            if (!getline(seqbegin, seqend) || !getline(seqend + 1, plusend) || !getline(plusend + 1, qualend))
+                break;
+
+            addbases(seqbegin, seqend);
+            offsets.push_back(numbases);
+
+            pos = qualend + 1;
+        }
+    }
+    else
+    {
+        for (; pos <= ownend && getline(pos, eol); pos = eol + 1)
+            if (buf[pos] == '>')
+                break;
+
+        while (pos <= ownend && getline(pos, eol) && buf[pos] == '>')
+        {
+            for (pos = eol + 1; getline(pos, eol) && buf[pos] != '>'; pos = eol + 1)
+                addbases(pos, eol);
+
+            offsets.push_back(numbases);
+        }
+    }
+
+    return ReadStore(std::move(buf), std::move(offsets));
+}
+
+ReadStream::Format ReadStream::GetFormat(const String& fname, SharedPtr<CommGrid> commgrid)
+{
+    /*
+     * Decided on the root from the first bytes of the file, or the first
+     * decompressed ones if it starts with a BGZF block.
+     */
+    int format = FASTA;
+
+    if (commgrid->GetRank() == 0)
+    {
+        Vector<char> head(BGZF_MAX_BLOCK_BYTES);
+        std::ifstream filestream(fname, std::ios::binary);
+
+        filestream.read(head.data(), head.size());
+        head.resize(filestream.gcount());
+
+        bool compressed = head.size() >= 2 && static_cast<uint8_t>(head[0]) == 31 && static_cast<uint8_t>(head[1]) == 139;
+
+        if (compressed)
+        {
+            size_t bsize = GetBgzfBlockSize(head.data(), head.size());
+
+            if (!bsize || bsize > head.size())
+            {
+                std::cerr << fname << " is gzip-compressed but not BGZF (compress it with bgzip)" << std::endl;
+                MPI_Abort(commgrid->GetWorld(), 1);
+            }
+
+            Vector<char> block;
+            InflateBgzfBlock(head.data(), bsize, block);
+            head.swap(block);
+        }
+
+        bool isfastq = !head.empty() && head.front() == '@';
+
+        format = compressed? (isfastq? BGZF_FASTQ : BGZF_FASTA) : (isfastq? FASTQ : FASTA);
+    }
+
+    MPI_Bcast(&format, 1, MPI_INT, 0, commgrid->GetWorld());
+
+    return static_cast<Format>(format);
+}
+
+bool ReadStream::IsStreamable(const String& fname, SharedPtr<CommGrid> commgrid)
+{
+    return GetFormat(fname, commgrid) != FASTA;
+}
+
+ReadStream::ReadStream(const String& fname, SharedPtr<CommGrid> commgrid) : commgrid(commgrid), fname(fname)
+{
+    format = GetFormat(fname, commgrid);
+}
+
+ReadStore ReadStream::GetMyReads()
+{
+    int nprocs = commgrid->GetSize();
+    int myrank = commgrid->GetRank();
+
+    MPI_File fh;
+    MPI_File_open(commgrid->GetWorld(), fname.c_str(), MPI_MODE_RDONLY, MPI_INFO_NULL, &fh);
+
+    MPI_Offset filesize;
+    MPI_File_get_size(fh, &filesize);
+
+    MPI_Offset begin = (filesize * myrank) / nprocs;
+    MPI_Offset end = (filesize * (myrank+1)) / nprocs;
+
+    bool fastq = format == FASTQ || format == BGZF_FASTQ;
+
+    ReadStore reads;
+
+    if (format == BGZF_FASTA || format == BGZF_FASTQ)
+    {
+        BgzfSource source(fh, filesize, begin, end);
+        reads = ParseReads(source, fastq);
+    }
+    else
+    {
+        PlainSource source(fh, filesize, begin, end);
+        reads = ParseReads(source, fastq);
+    }
+
+    MPI_File_close(&fh);
+
+    return reads;
+}
@@ -0,0 +1,531 @@
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <cstdint>
+#include <cassert>
+#include <numeric>
+#include <algorithm>
+#include <cstring>
+#include <mpi.h>
+#include "common.h"
+#include "Kmer.h"
+#include "KmerComm.h"
+#include "FastaIndex.h"
+#include "ReadStream.h"
+#include "ReadOverlap.h"
+#include "KmerIntersect.h"
+#include "SeedOverlap.h"
+#include "OverlapFile.h"
+#include "SeedCheckpoint.h"
+#include "Pipeline.h"
+#include "Logger.h"
+#include "Profiler.h"
+#include "Exchange.h"
+
+/*
+ * One instance of the pipeline. The Makefile compiles this file once for every
+ * configuration in PIPELINES, with its own KMER_SIZE, LOWER_KMER_FREQ,
+ * UPPER_KMER_FREQ, USE_BLOOM and PIPELINE_NAMESPACE.
+ */
+
+#if SLIM_OVERLAPS == 1
+typedef SeedOverlap OverlapValue;
+typedef SeedIntersect OverlapSemiring;
+#else
+static_assert(SLIM_OVERLAPS == 0);
+typedef ReadOverlap OverlapValue;
+typedef KmerIntersect OverlapSemiring;
+#endif
+
+typedef CT<OverlapValue>::PSpParMat OverlapMatrix;
+
+static void PrintKmerHistogram(const KmerCountMap& kmermap, SharedPtr<CommGrid>& commgrid);
+static OverlapMatrix GetOverlapMatrix(CT<PosInRead>::PSpParMat& A, CT<PosInRead>::PSpParMat& AT);
+static CT<PosInRead>::PSpParMat GetSeedMatrix(const KmerCountMap& kmermap, uint64_t firstkmerid, uint64_t totreads, uint64_t totkmers, bool transpose, SharedPtr<CommGrid> commgrid);
+static void FindOverlaps(const PipelineArgs& args, SharedPtr<CommGrid> commgrid);
+static void FindOverlapsFromCheckpoint(const PipelineArgs& args, SharedPtr<CommGrid> commgrid);
+static void WriteOverlaps(CT<PosInRead>::PSpParMat& A, CT<PosInRead>::PSpParMat& AT);
+
+static void RunPipeline(const PipelineArgs& args, SharedPtr<CommGrid> commgrid)
+{
+    MPI_Comm gridworld = commgrid->GetWorld();
+    int myrank = commgrid->GetRank();
+    int nprocs = commgrid->GetSize();
+
+    PhaseTimer totaltimer(PROFILE_TOTAL);
+
+    if (!myrank)
+    {
+        std::cout << "-DKMER_SIZE=" << KMER_SIZE << " "
+                  << "-DLOWER_KMER_FREQ=" << LOWER_KMER_FREQ << " "
+                  << "-DUPPER_KMER_FREQ=" << UPPER_KMER_FREQ << " "
+                  << "-DUSE_BLOOM=" << USE_BLOOM << " "
+                  << "-DFUSED_KMER_PASS=" << FUSED_KMER_PASS << " "
+                  << "-DCSR_SEEDS=" << CSR_SEEDS << " "
+                  << "-DSORT_COUNTING=" << SORT_COUNTING << " "
+                  << "-DSEED_BATCH_MB=" << SEED_BATCH_MB << " "
+                  << "-DCOMPACT_SEEDS=" << COMPACT_SEEDS << " "
+                  << "-DUSE_OPENMP=" << USE_OPENMP << " "
+                  << "-DBLOCKED_BLOOM=" << BLOCKED_BLOOM << " "
+                  << "-DSKEW_AWARE_PARTITION=" << SKEW_AWARE_PARTITION << " "
+                  << "-DPREAGGREGATE_KMERS=" << PREAGGREGATE_KMERS << " "
+                  << "-DBALANCED_READS=" << BALANCED_READS << " "
+                  << "-DPARALLEL_FAIDX=" << PARALLEL_FAIDX << " "
+                  << "-DPACKED_READS=" << PACKED_READS << " "
+                  << "-DSEED_POLICY=" << SEED_POLICY << " "
+                  << "-DMINIMIZER_WINDOW=" << MINIMIZER_WINDOW << " "
+                  << "-DSYNCMER_SIZE=" << SYNCMER_SIZE << " "
+                  << "-DKMER_SIMD=" << KMER_SIMD << " "
+                  << "-DSLIM_OVERLAPS=" << SLIM_OVERLAPS << " "
+                  << "-DMIN_OVERLAP_SEEDS=" << MIN_OVERLAP_SEEDS << " "
+                  << "-DOVERLAP_PHASES=" << OVERLAP_PHASES << " "
+                  << "-DSYMMETRIC_OVERLAPS=" << SYMMETRIC_OVERLAPS << " "
+                  << "-DDIRECT_SEED_MATRIX=" << DIRECT_SEED_MATRIX << " "
+                  << "-DOVERLAP_OUTPUT=" << OVERLAP_OUTPUT << " "
+                  << "-DHIERARCHICAL_EXCHANGE=" << HIERARCHICAL_EXCHANGE << "\n" << std::endl;
+    }
+
+    MPI_Barrier(gridworld);
+
+    if (args.restart_fname.empty())
+        FindOverlaps(args, commgrid);
+    else
+        FindOverlapsFromCheckpoint(args, commgrid);
+
+    totaltimer.Stop();
+
+    WriteProfile("profile.json", {KMER_SIZE, LOWER_KMER_FREQ, UPPER_KMER_FREQ, USE_BLOOM}, commgrid);
+}
+
+static void FindOverlaps(const PipelineArgs& args, SharedPtr<CommGrid> commgrid)
+{
+    MPI_Comm gridworld = commgrid->GetWorld();
+    int myrank = commgrid->GetRank();
+
+    PhaseTimer parsetimer(PROFILE_PARSE);
+
+    ReadStore myreads;
+
+    if (ReadStream::IsStreamable(args.fasta_fname, commgrid))
+    {
+        ReadStream stream(args.fasta_fname, commgrid);
+        myreads = stream.GetMyReads();
+    }
+    else
+    {
+        FastaIndex index(args.fasta_fname, commgrid);
+        myreads = index.GetMyReads();
+    }
+
+    parsetimer.Stop();
+
+    KmerCountMap kmermap = GetKmerCountMapKeys(myreads, commgrid);
+
+    size_t numkmers = kmermap.size();
+    MPI_Allreduce(MPI_IN_PLACE, &numkmers, 1, MPI_SIZE_T, MPI_SUM, commgrid->GetWorld());
+
+    if (!myrank)
+    {
+#if USE_BLOOM == 1
+        std::cout << "A total of " << numkmers << " likely non-singleton 'column' k-mers found\n" << std::endl;
+#else
+        std::cout << "A total of " << numkmers << " 'column' k-mers found\n" << std::endl;
+#endif
+    }
+    MPI_Barrier(gridworld);
+
+#if CSR_SEEDS == 1
+    KmerSeedBuffer seedbuf;
+    GetKmerCountMapValues(myreads, kmermap, seedbuf, commgrid);
+#else
+    GetKmerCountMapValues(myreads, kmermap, commgrid);
+#endif
+
+    kmermap.erase_if([](const auto& entry) { return std::get<2>(entry.second) < LOWER_KMER_FREQ; });
+
+    numkmers = kmermap.size();
+    MPI_Allreduce(MPI_IN_PLACE, &numkmers, 1, MPI_SIZE_T, MPI_SUM, commgrid->GetWorld());
+    if (!myrank)
+    {
+        std::cout << "A total of " << numkmers << " reliable 'column' k-mers found\n" << std::endl;
+    }
+    MPI_Barrier(gridworld);
+
+    PrintKmerHistogram(kmermap, commgrid);
+
+    PhaseTimer matrixtimer(PROFILE_MATRIX);
+
+    uint64_t kmerid = kmermap.size();
+    uint64_t totkmers = kmerid;
+    uint64_t totreads = myreads.size();
+
+    MPI_Allreduce(&kmerid,      &totkmers, 1, MPI_UINT64_T, MPI_SUM, commgrid->GetWorld());
+    MPI_Allreduce(MPI_IN_PLACE, &totreads, 1, MPI_UINT64_T, MPI_SUM, commgrid->GetWorld());
+
+    MPI_Exscan(MPI_IN_PLACE, &kmerid, 1, MPI_UINT64_T, MPI_SUM, commgrid->GetWorld());
+    if (myrank == 0) kmerid = 0;
+
+#if DIRECT_SEED_MATRIX == 1
+    CT<PosInRead>::PSpParMat A = GetSeedMatrix(kmermap, kmerid, totreads, totkmers, false, commgrid);
+
+#if SYMMETRIC_OVERLAPS == 1
+    CT<PosInRead>::PSpParMat AT = GetSeedMatrix(kmermap, kmerid, totreads, totkmers, true, commgrid);
+#else
+    static_assert(SYMMETRIC_OVERLAPS == 0);
+    auto AT = A;
+    AT.Transpose();
+#endif
+#else
+    static_assert(DIRECT_SEED_MATRIX == 0);
+
+#if CSR_SEEDS == 1
+    /*
+     * The occurrence buffer already holds the row ids and positions of the
+     * nonzeros, in the same order as the k-mers in kmermap, so only the
+     * column ids need to be generated.
+     */
+    Vector<uint64_t> local_rowids(std::move(seedbuf.readids));
+    Vector<PosInRead> local_positions(std::move(seedbuf.positions));
+    Vector<uint64_t> local_colids(local_rowids.size());
+
+    auto colitr = local_colids.begin();
+
+    for (auto itr = kmermap.begin(); itr != kmermap.end(); ++itr)
+    {
+        colitr = std::fill_n(colitr, std::get<2>(itr->second), kmerid++);
+    }
+
+    assert(colitr == local_colids.end());
+#else
+    Vector<uint64_t> local_rowids, local_colids;
+    Vector<PosInRead> local_positions;
+
+    for (auto itr = kmermap.begin(); itr != kmermap.end(); ++itr)
+    {
+        READIDS& readids = std::get<0>(itr->second);
+        POSITIONS& positions = std::get<1>(itr->second);
+        int cnt = std::get<2>(itr->second);
+
+        for (int j = 0; j < cnt; ++j)
+        {
+            local_colids.push_back(kmerid);
+            local_rowids.push_back(readids[j]);
+            local_positions.push_back(positions[j]);
+        }
+
+        kmerid++;
+    }
+#endif
+
+    CT<uint64_t>::PDistVec drows(local_rowids, commgrid);
+    CT<uint64_t>::PDistVec dcols(local_colids, commgrid);
+    CT<PosInRead>::PDistVec dvals(local_positions, commgrid);
+
+    CT<PosInRead>::PSpParMat A(totreads, totkmers, drows, dcols, dvals, true);
+
+#if SYMMETRIC_OVERLAPS == 1
+    /*
+     * AT is built from the same triples with the rows and columns swapped,
+     * instead of copying A and transposing the copy.
+     */
+    CT<PosInRead>::PSpParMat AT(totkmers, totreads, dcols, drows, dvals, true);
+#else
+    static_assert(SYMMETRIC_OVERLAPS == 0);
+    auto AT = A;
+    AT.Transpose();
+#endif
+#endif
+
+    matrixtimer.Stop();
+
+    if (!args.checkpoint_fname.empty())
+    {
+        PhaseTimer checkpointtimer(PROFILE_WRITE);
+        SaveSeedMatrix(A, args.checkpoint_fname);
+    }
+
+    WriteOverlaps(A, AT);
+}
+
+static void FindOverlapsFromCheckpoint(const PipelineArgs& args, SharedPtr<CommGrid> commgrid)
+{
+    PhaseTimer matrixtimer(PROFILE_MATRIX);
+
+    Vector<uint64_t> local_rowids, local_colids;
+    Vector<PosInRead> local_positions;
+    uint64_t totreads, totkmers;
+
+    LoadSeedMatrix(args.restart_fname, local_rowids, local_colids, local_positions, totreads, totkmers, commgrid);
+
+    CT<uint64_t>::PDistVec drows(local_rowids, commgrid);
+    CT<uint64_t>::PDistVec dcols(local_colids, commgrid);
+    CT<PosInRead>::PDistVec dvals(local_positions, commgrid);
+
+    CT<PosInRead>::PSpParMat A(totreads, totkmers, drows, dcols, dvals, true);
+
+#if SYMMETRIC_OVERLAPS == 1
+    CT<PosInRead>::PSpParMat AT(totkmers, totreads, dcols, drows, dvals, true);
+#else
+    static_assert(SYMMETRIC_OVERLAPS == 0);
+    auto AT = A;
+    AT.Transpose();
+#endif
+
+    matrixtimer.Stop();
+
+    /*
+     * Writing A back to the checkpoint it was just read from would only
+     * rewrite the same file.
+     */
+    if (!args.checkpoint_fname.empty() && args.checkpoint_fname != args.restart_fname)
+    {
+        PhaseTimer checkpointtimer(PROFILE_WRITE);
+        SaveSeedMatrix(A, args.checkpoint_fname);
+    }
+
+    WriteOverlaps(A, AT);
+}
+
+static void WriteOverlaps(CT<PosInRead>::PSpParMat& A, CT<PosInRead>::PSpParMat& AT)
+{
+    PhaseTimer spgemmtimer(PROFILE_SPGEMM);
+    OverlapMatrix B = GetOverlapMatrix(A, AT);
+    spgemmtimer.Stop();
+
+    PhaseTimer writetimer(PROFILE_WRITE);
+
+#if OVERLAP_OUTPUT == 0
+    B.ParallelWriteMM("B.mtx", false, OverlapHandler());
+#elif OVERLAP_OUTPUT == 1
+    WriteOverlapFile(B, "B.bin", false);
+#else
+    static_assert(OVERLAP_OUTPUT == 2);
+    WriteOverlapFile(B, "B.bin", true);
+#endif
+
+    writetimer.Stop();
+}
+
+static CT<PosInRead>::PSpParMat GetSeedMatrix(const KmerCountMap& kmermap, uint64_t firstkmerid, uint64_t totreads, uint64_t totkmers, bool transpose, SharedPtr<CommGrid> commgrid)
+{
+    /*
+     * Sends every nonzero (readid, kmerid, pos) of A, whose k-mers are the
+     * local k-mers of @kmermap numbered from @firstkmerid on, straight to the
+     * processor that owns it in the 2D distribution of A, the same one that
+     * SpParMat::Owner would pick. Every processor then assembles its tile as
+     * an SpDCCols. With @transpose, builds AT instead.
+     */
+    int nprocs = commgrid->GetSize();
+    int procrows = commgrid->GetGridRows();
+    int proccols = commgrid->GetGridCols();
+
+    uint64_t numrows = transpose? totkmers : totreads;
+    uint64_t numcols = transpose? totreads : totkmers;
+    uint64_t rowsperproc = numrows / procrows;
+    uint64_t colsperproc = numcols / proccols;
+
+    auto getblock = [](uint64_t id, uint64_t perproc, int numblocks) { return perproc? std::min(static_cast<int>(id / perproc), numblocks-1) : numblocks-1; };
+
+    auto foreach_nonzero = [&](auto&& handler)
+    {
+        uint64_t kmerid = firstkmerid;
+
+        for (auto itr = kmermap.cbegin(); itr != kmermap.cend(); ++itr, ++kmerid)
+        {
+            const READIDS& readids = std::get<0>(itr->second);
+            const POSITIONS& positions = std::get<1>(itr->second);
+            int cnt = std::get<2>(itr->second);
+
+            for (int j = 0; j < cnt; ++j)
+            {
+                uint64_t row = transpose? kmerid : readids[j];
+                uint64_t col = transpose? readids[j] : kmerid;
+                int owner = getblock(row, rowsperproc, procrows) * proccols + getblock(col, colsperproc, proccols);
+
+                handler(owner, row, col, positions[j]);
+            }
+        }
+    };
+
+    constexpr size_t recbytes = 2 * sizeof(uint64_t) + sizeof(PosInRead);
+
+    Vector<MPI_Count_type> sendcnt(nprocs, 0), recvcnt(nprocs);
+    Vector<MPI_Displ_type> sdispls(nprocs), rdispls(nprocs);
+
+    foreach_nonzero([&](int owner, uint64_t row, uint64_t col, PosInRead pos) { sendcnt[owner] += recbytes; });
+
+    ExchangePlan plan(PROFILE_MATRIX);
+    ExchangeCounts(sendcnt, recvcnt, plan, commgrid);
+
+    GetSendDispls(sendcnt, sdispls, commgrid);
+
+    rdispls.front() = 0;
+    std::partial_sum(recvcnt.begin(), recvcnt.end()-1, rdispls.begin()+1);
+
+    Vector<uint8_t> sendbuf(std::accumulate(sendcnt.begin(), sendcnt.end(), static_cast<size_t>(0)));
+    Vector<uint8_t> recvbuf(rdispls.back() + recvcnt.back());
+
+    Vector<MPI_Displ_type> fillptrs(sdispls);
+
+    foreach_nonzero([&](int owner, uint64_t row, uint64_t col, PosInRead pos)
+    {
+        uint8_t *addrs2fill = sendbuf.data() + fillptrs[owner];
+
+        std::memcpy(addrs2fill, &row, sizeof(uint64_t));
+        std::memcpy(addrs2fill + sizeof(uint64_t), &col, sizeof(uint64_t));
+        std::memcpy(addrs2fill + 2 * sizeof(uint64_t), &pos, sizeof(PosInRead));
+
+        fillptrs[owner] += recbytes;
+    });
+
+    ExchangeBytes(sendbuf.data(), sendcnt, sdispls, recvbuf.data(), recvcnt, rdispls, plan, commgrid);
+
+    Vector<uint8_t>().swap(sendbuf);
+
+    /*
+     * The last processor row and column also get the rows and columns that
+     * don't divide evenly.
+     */
+    int myprocrow = commgrid->GetRankInProcCol();
+    int myproccol = commgrid->GetRankInProcRow();
+
+    uint64_t rowoffset = myprocrow * rowsperproc;
+    uint64_t coloffset = myproccol * colsperproc;
+    uint64_t locrows = myprocrow == procrows-1? numrows - rowoffset : rowsperproc;
+    uint64_t loccols = myproccol == proccols-1? numcols - coloffset : colsperproc;
+
+    /*
+     * The SpTuples below take ownership of the tuples, but only free them if
+     * there are any, so nothing is allocated when there are none.
+     */
+    size_t numnonzeros = recvbuf.size() / recbytes;
+    auto tuples = numnonzeros? new std::tuple<uint64_t, uint64_t, PosInRead>[numnonzeros] : nullptr;
+
+    for (size_t i = 0; i < numnonzeros; ++i)
+    {
+        const uint8_t *addrs2read = recvbuf.data() + i * recbytes;
+
+        uint64_t row, col;
+        PosInRead pos;
+
+        std::memcpy(&row, addrs2read, sizeof(uint64_t));
+        std::memcpy(&col, addrs2read + sizeof(uint64_t), sizeof(uint64_t));
+        std::memcpy(&pos, addrs2read + 2 * sizeof(uint64_t), sizeof(PosInRead));
+
+        tuples[i] = std::make_tuple(row - rowoffset, col - coloffset, pos);
+    }
+
+    Vector<uint8_t>().swap(recvbuf);
+
+    /*
+     * SpDCCols wants the tuples in column-major order and without duplicates.
+     * A k-mer that occurs more than once in a read gives duplicates, which are
+     * summed, as the triples constructor of SpParMat does.
+     */
+    std::sort(tuples, tuples + numnonzeros, [](const auto& a, const auto& b) { return std::tie(std::get<1>(a), std::get<0>(a)) < std::tie(std::get<1>(b), std::get<0>(b)); });
+
+    size_t numunique = 0;
+
+    for (size_t i = 0; i < numnonzeros; ++i)
+    {
+        if (numunique && std::get<0>(tuples[numunique-1]) == std::get<0>(tuples[i]) && std::get<1>(tuples[numunique-1]) == std::get<1>(tuples[i]))
+            std::get<2>(tuples[numunique-1]) += std::get<2>(tuples[i]);
+        else
+            tuples[numunique++] = tuples[i];
+    }
+
+    auto spseq = new CT<PosInRead>::PSpDCCols(SpTuples<uint64_t, PosInRead>(numunique, locrows, loccols, tuples, true), false);
+
+    return CT<PosInRead>::PSpParMat(spseq, commgrid);
+}
+
+static OverlapMatrix GetOverlapMatrix(CT<PosInRead>::PSpParMat& A, CT<PosInRead>::PSpParMat& AT)
+{
+    auto prune = [](const OverlapValue& item) { return item.count < MIN_OVERLAP_SEEDS; };
+#if SYMMETRIC_OVERLAPS == 1
+    auto prunelower = [](const auto& nz) { return std::get<0>(nz) >= std::get<1>(nz); };
+#endif
+
+#if OVERLAP_PHASES == 1
+    OverlapMatrix B = Mult_AnXBn_DoubleBuff<OverlapSemiring, OverlapValue, CT<OverlapValue>::PSpDCCols>(A, AT);
+    B.Prune(prune);
+    return B;
+#else
+    /*
+     * Phase i multiplies A by the i-th slice of the columns of AT, which gives
+     * the same columns of B, and prunes them right away. The slices don't share
+     * any entries, so adding them up just concatenates them.
+     */
+    uint64_t numcols = AT.getncol();
+    uint64_t slicesize = (numcols + OVERLAP_PHASES - 1) / OVERLAP_PHASES;
+
+    auto getslice = [&](int i)
+    {
+        uint64_t firstcol = i * slicesize;
+        uint64_t lastcol = std::min(numcols, firstcol + slicesize);
+
+        auto ATslice = AT.PruneI([firstcol, lastcol](const auto& nz) { return std::get<1>(nz) < firstcol || std::get<1>(nz) >= lastcol; }, false);
+
+#if SYMMETRIC_OVERLAPS == 1
+        /*
+         * Only the rows above the last column of the slice can give entries
+         * above the diagonal.
+         */
+        auto Aslice = A.PruneI([lastcol](const auto& nz) { return std::get<0>(nz) >= lastcol; }, false);
+
+        OverlapMatrix Bslice = Mult_AnXBn_DoubleBuff<OverlapSemiring, OverlapValue, CT<OverlapValue>::PSpDCCols>(Aslice, ATslice, true, true);
+        Bslice.Prune(prune);
+        Bslice.PruneI(prunelower);
+#else
+        OverlapMatrix Bslice = Mult_AnXBn_DoubleBuff<OverlapSemiring, OverlapValue, CT<OverlapValue>::PSpDCCols>(A, ATslice, false, true);
+        Bslice.Prune(prune);
+#endif
+        return Bslice;
+    };
+
+    OverlapMatrix B = getslice(0);
+
+    for (int i = 1; i < OVERLAP_PHASES; ++i)
+    {
+        B += getslice(i);
+    }
+
+    return B;
+#endif
+}
+
+static PipelineRegistrar registrar({KMER_SIZE, LOWER_KMER_FREQ, UPPER_KMER_FREQ, USE_BLOOM}, RunPipeline);
+
+static void PrintKmerHistogram(const KmerCountMap& kmermap, SharedPtr<CommGrid>& commgrid)
+{
+    int maxcount = std::accumulate(kmermap.cbegin(), kmermap.cend(), 0, [](int cur, const auto& entry) { return std::max(cur, std::get<2>(entry.second)); });
+
+    MPI_Allreduce(MPI_IN_PLACE, &maxcount, 1, MPI_INT, MPI_MAX, commgrid->GetWorld());
+
+    Vector<int> histo(maxcount+1, 0);
+
+    for (auto itr = kmermap.cbegin(); itr != kmermap.cend(); ++itr)
+    {
+        int cnt = std::get<2>(itr->second);
+        assert(cnt >= 1);
+        histo[cnt]++;
+    }
+
+    MPI_Allreduce(MPI_IN_PLACE, histo.data(), maxcount+1, MPI_INT, MPI_SUM, commgrid->GetWorld());
+
+    int myrank = commgrid->GetRank();
+
+    if (!myrank)
+    {
+        std::cout << "#count\tnumkmers" << std::endl;
+
+        for (int i = 1; i < histo.size(); ++i)
+        {
+            if (histo[i] > 0)
+            {
+                std::cout << i << "\t" << histo[i] << std::endl;
+            }
+        }
+    }
+}
+
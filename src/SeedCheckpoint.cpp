@@ -0,0 +1,176 @@
+#include "SeedCheckpoint.h"
+#include <cstring>
+#include <iostream>
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "checkpoints are written in host byte order");
+
+inline namespace PIPELINE_NAMESPACE {
+
+static_assert(sizeof(SeedCheckpointHeader) == 64);
+static_assert(sizeof(PosInRead) == 2);
+
+static SeedCheckpointHeader GetHeader()
+{
+    SeedCheckpointHeader header = {};
+
+    std::memcpy(header.magic, "ELBASMX", 8);
+    header.version = 1;
+    header.kmersize = KMER_SIZE;
+    header.lowerfreq = LOWER_KMER_FREQ;
+    header.upperfreq = UPPER_KMER_FREQ;
+    header.usebloom = USE_BLOOM;
+    header.seedpolicy = SEED_POLICY;
+
+#if SEED_POLICY == 1
+    header.seedwindow = MINIMIZER_WINDOW;
+#elif SEED_POLICY == 2
+    header.seedwindow = SYNCMER_SIZE;
+#endif
+
+    return header;
+}
+
+/*
+ * Whether the checkpoint @header was written by a pipeline instance that
+ * computes the same A as this one.
+ */
+static bool IsCompatible(const SeedCheckpointHeader& header)
+{
+    SeedCheckpointHeader mine = GetHeader();
+
+    return !std::memcmp(header.magic, mine.magic, 8) &&
+           header.version    == mine.version    &&
+           header.kmersize   == mine.kmersize   &&
+           header.lowerfreq  == mine.lowerfreq  &&
+           header.upperfreq  == mine.upperfreq  &&
+           header.usebloom   == mine.usebloom   &&
+           header.seedpolicy == mine.seedpolicy &&
+           header.seedwindow == mine.seedwindow;
+}
+
+void SaveSeedMatrix(CT<PosInRead>::PSpParMat& A, const String& fname)
+{
+    auto commgrid = A.getcommgrid();
+
+    int myrank = commgrid->GetRank();
+
+    /*
+     * The global ids of the tile's first row and column are the numbers of
+     * rows and columns of the tiles above it and to its left.
+     */
+    uint64_t locrows = A.seq().getnrow(), rowoffset = 0;
+    uint64_t loccols = A.seq().getncol(), coloffset = 0;
+
+    MPI_Exscan(&locrows, &rowoffset, 1, MPI_UINT64_T, MPI_SUM, commgrid->GetColWorld());
+    MPI_Exscan(&loccols, &coloffset, 1, MPI_UINT64_T, MPI_SUM, commgrid->GetRowWorld());
+
+    if (!commgrid->GetRankInProcCol()) rowoffset = 0;
+    if (!commgrid->GetRankInProcRow()) coloffset = 0;
+
+    Vector<uint64_t> rowids, colids;
+    Vector<PosInRead> positions;
+
+    rowids.reserve(A.seq().getnnz());
+    colids.reserve(A.seq().getnnz());
+    positions.reserve(A.seq().getnnz());
+
+    for (auto colit = A.seq().begcol(); colit != A.seq().endcol(); ++colit)
+    {
+        for (auto nzit = A.seq().begnz(colit); nzit != A.seq().endnz(colit); ++nzit)
+        {
+            rowids.push_back(nzit.rowid() + rowoffset);
+            colids.push_back(colit.colid() + coloffset);
+            positions.push_back(nzit.value());
+        }
+    }
+
+    uint64_t mynnz = rowids.size(), totnnz = 0, mynnzoffset = 0;
+
+    MPI_Allreduce(&mynnz, &totnnz, 1, MPI_UINT64_T, MPI_SUM, commgrid->GetWorld());
+    MPI_Exscan(&mynnz, &mynnzoffset, 1, MPI_UINT64_T, MPI_SUM, commgrid->GetWorld());
+    if (!myrank) mynnzoffset = 0;
+
+    SeedCheckpointHeader header = GetHeader();
+
+    header.numrows = A.getnrow();
+    header.numcols = A.getncol();
+    header.numnonzeros = totnnz;
+
+    MPI_File fh;
+
+    if (MPI_File_open(commgrid->GetWorld(), fname.c_str(), MPI_MODE_WRONLY | MPI_MODE_CREATE, MPI_INFO_NULL, &fh) != MPI_SUCCESS)
+    {
+        if (!myrank) std::cerr << "could not open " << fname << " for writing, no checkpoint was written" << std::endl;
+        return;
+    }
+
+    MPI_File_set_size(fh, 0);
+
+    MPI_Offset rowsoffset = sizeof(header);
+    MPI_Offset colsoffset = rowsoffset + totnnz * sizeof(uint64_t);
+    MPI_Offset posoffset = colsoffset + totnnz * sizeof(uint64_t);
+
+    MPI_FILE_WRITE_AT_ALL(fh, 0, &header, myrank? 0 : sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE);
+    MPI_FILE_WRITE_AT_ALL(fh, rowsoffset + mynnzoffset * sizeof(uint64_t), rowids.data(), mynnz, MPI_UINT64_T, MPI_STATUS_IGNORE);
+    MPI_FILE_WRITE_AT_ALL(fh, colsoffset + mynnzoffset * sizeof(uint64_t), colids.data(), mynnz, MPI_UINT64_T, MPI_STATUS_IGNORE);
+    MPI_FILE_WRITE_AT_ALL(fh, posoffset + mynnzoffset * sizeof(PosInRead), positions.data(), mynnz, MPI_UINT16_T, MPI_STATUS_IGNORE);
+
+    MPI_File_close(&fh);
+
+    if (!myrank)
+    {
+        std::cout << "wrote the " << totnnz << " nonzeros of A to checkpoint " << fname << "\n" << std::endl;
+    }
+}
+
+void LoadSeedMatrix(const String& fname, Vector<uint64_t>& rowids, Vector<uint64_t>& colids, Vector<PosInRead>& positions, uint64_t& numrows, uint64_t& numcols, SharedPtr<CommGrid> commgrid)
+{
+    int myrank = commgrid->GetRank();
+    int nprocs = commgrid->GetSize();
+
+    MPI_File fh;
+
+    if (MPI_File_open(commgrid->GetWorld(), fname.c_str(), MPI_MODE_RDONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS)
+    {
+        if (!myrank) std::cerr << "could not open checkpoint " << fname << std::endl;
+        MPI_Abort(commgrid->GetWorld(), 1);
+    }
+
+    SeedCheckpointHeader header;
+
+    MPI_FILE_READ_AT_ALL(fh, 0, &header, sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE);
+
+    if (!IsCompatible(header))
+    {
+        if (!myrank) std::cerr << fname << " is not a checkpoint of this pipeline instance (-DKMER_SIZE=" << KMER_SIZE << " -DLOWER_KMER_FREQ=" << LOWER_KMER_FREQ << " -DUPPER_KMER_FREQ=" << UPPER_KMER_FREQ << " -DUSE_BLOOM=" << USE_BLOOM << " -DSEED_POLICY=" << SEED_POLICY << ")" << std::endl;
+        MPI_Abort(commgrid->GetWorld(), 1);
+    }
+
+    numrows = header.numrows;
+    numcols = header.numcols;
+
+    uint64_t totnnz = header.numnonzeros;
+    uint64_t first = (totnnz * myrank) / nprocs;
+    uint64_t mynnz = (totnnz * (myrank+1)) / nprocs - first;
+
+    rowids.resize(mynnz);
+    colids.resize(mynnz);
+    positions.resize(mynnz);
+
+    MPI_Offset rowsoffset = sizeof(header);
+    MPI_Offset colsoffset = rowsoffset + totnnz * sizeof(uint64_t);
+    MPI_Offset posoffset = colsoffset + totnnz * sizeof(uint64_t);
+
+    MPI_FILE_READ_AT_ALL(fh, rowsoffset + first * sizeof(uint64_t), rowids.data(), mynnz, MPI_UINT64_T, MPI_STATUS_IGNORE);
+    MPI_FILE_READ_AT_ALL(fh, colsoffset + first * sizeof(uint64_t), colids.data(), mynnz, MPI_UINT64_T, MPI_STATUS_IGNORE);
+    MPI_FILE_READ_AT_ALL(fh, posoffset + first * sizeof(PosInRead), positions.data(), mynnz, MPI_UINT16_T, MPI_STATUS_IGNORE);
+
+    MPI_File_close(&fh);
+
+    if (!myrank)
+    {
+        std::cout << "read the " << totnnz << " nonzeros of a " << numrows << " by " << numcols << " A from checkpoint " << fname << "\n" << std::endl;
+    }
+}
+
+} /* namespace PIPELINE_NAMESPACE */